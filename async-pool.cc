@@ -0,0 +1,217 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of this project nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <assert.h>
+
+// po6
+#include <po6/threads/mutex.h>
+
+// kvbench
+#include "async-pool.h"
+
+async_pool :: async_pool(database* db, unsigned idx, unsigned threads)
+    : m_db(db)
+    , m_idx(idx)
+    , m_threads(threads)
+    , m_mtx()
+    , m_submitted(&m_mtx)
+    , m_completed(&m_mtx)
+    , m_workers()
+    , m_pending()
+    , m_done()
+    , m_reaped()
+    , m_started(0)
+    , m_ready(0)
+    , m_failed(false)
+    , m_stopping(false)
+{
+}
+
+async_pool :: ~async_pool() throw ()
+{
+    stop();
+}
+
+// Returns once every worker has set up its database thread state.
+bool
+async_pool :: start()
+{
+    for (unsigned i = 0; i < m_threads; ++i)
+    {
+        using namespace po6::threads;
+        thread_ptr t(new thread(make_obj_func(&async_pool::worker, this)));
+        m_workers.push_back(t);
+        t->start();
+    }
+
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    while (m_ready < m_workers.size())
+    {
+        m_completed.wait();
+    }
+
+    return !m_failed;
+}
+
+bool
+async_pool :: submit(database_op* op)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    m_pending.push_back(op);
+    m_submitted.signal();
+    return !m_failed;
+}
+
+bool
+async_pool :: poll(unsigned min)
+{
+    assert(m_reaped.empty());
+
+    {
+        po6::threads::mutex::hold hold(&m_mtx);
+
+        while (m_done.size() < min && !m_failed)
+        {
+            m_completed.wait();
+        }
+
+        if (m_failed)
+        {
+            return false;
+        }
+
+        m_reaped.assign(m_done.begin(), m_done.end());
+        m_done.clear();
+    }
+
+    for (size_t i = 0; i < m_reaped.size(); ++i)
+    {
+        m_reaped[i].first->callback(m_reaped[i].first, m_reaped[i].second);
+    }
+
+    m_reaped.clear();
+    return true;
+}
+
+// Runs every op already submitted, without calling back, and joins the
+// workers.
+bool
+async_pool :: stop()
+{
+    {
+        po6::threads::mutex::hold hold(&m_mtx);
+        m_stopping = true;
+        m_submitted.broadcast();
+    }
+
+    for (size_t i = 0; i < m_workers.size(); ++i)
+    {
+        m_workers[i]->join();
+    }
+
+    m_workers.clear();
+    po6::threads::mutex::hold hold(&m_mtx);
+    return !m_failed;
+}
+
+void
+async_pool :: worker()
+{
+    void* ptr = NULL;
+    unsigned idx = 0;
+
+    {
+        po6::threads::mutex::hold hold(&m_mtx);
+        idx = m_idx + m_started;
+        ++m_started;
+    }
+
+    bool ready = m_db->setup_thread(idx, &ptr);
+
+    {
+        po6::threads::mutex::hold hold(&m_mtx);
+        ++m_ready;
+        m_failed = m_failed || !ready;
+        m_completed.broadcast();
+    }
+
+    while (ready)
+    {
+        database_op* op = NULL;
+
+        {
+            po6::threads::mutex::hold hold(&m_mtx);
+
+            while (m_pending.empty() && !m_stopping)
+            {
+                m_submitted.wait();
+            }
+
+            if (m_pending.empty())
+            {
+                break;
+            }
+
+            op = m_pending.front();
+            m_pending.pop_front();
+        }
+
+        bool success = execute(ptr, op);
+        po6::threads::mutex::hold hold(&m_mtx);
+        m_done.push_back(std::make_pair(op, success));
+        m_completed.signal();
+    }
+
+    if (ready && !m_db->teardown_thread(ptr))
+    {
+        std::cerr << "database thread state teardown failed\n" << std::flush;
+        po6::threads::mutex::hold hold(&m_mtx);
+        m_failed = true;
+        m_completed.broadcast();
+    }
+}
+
+bool
+async_pool :: execute(void* ptr, database_op* op)
+{
+    switch (op->type)
+    {
+        case 'R':
+            return m_db->get(ptr, op->key, op->key_sz);
+        case 'W':
+            return m_db->put(ptr, op->key, op->key_sz, op->val, op->val_sz);
+        case 'D':
+            return m_db->del(ptr, op->key, op->key_sz);
+        case 'S':
+            return m_db->scan(ptr, op->key, op->key_sz, op->num);
+        default:
+            std::cerr << "corrupt internal state\n";
+            return false;
+    }
+}
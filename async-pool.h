@@ -0,0 +1,92 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of this project nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef kvbench_async_pool_h_
+#define kvbench_async_pool_h_
+
+// STL
+#include <deque>
+#include <utility>
+#include <vector>
+
+// po6
+#include <po6/threads/cond.h>
+#include <po6/threads/mutex.h>
+#include <po6/threads/thread.h>
+
+// e
+#include <e/compat.h>
+
+// kvbench
+#include "database.h"
+
+// The asynchronous calls for databases without native support.  Each pool
+// belongs to one submitting thread and runs its ops on threads of its own,
+// each with its own database thread state, using the synchronous calls.
+// The workers take the indices idx through idx + threads - 1.  Completed
+// ops wait until the submitting thread polls, so that callbacks always
+// run on the thread that submitted them.
+class async_pool
+{
+    public:
+        async_pool(database* db, unsigned idx, unsigned threads);
+        ~async_pool() throw ();
+
+    public:
+        bool start();
+        bool submit(database_op* op);
+        bool poll(unsigned min);
+        bool stop();
+
+    private:
+        typedef e::compat::shared_ptr<po6::threads::thread> thread_ptr;
+        typedef std::pair<database_op*, bool> completion;
+        void worker();
+        bool execute(void* ptr, database_op* op);
+
+    private:
+        database* m_db;
+        unsigned m_idx;
+        unsigned m_threads;
+        po6::threads::mutex m_mtx;
+        po6::threads::cond m_submitted;
+        po6::threads::cond m_completed;
+        std::vector<thread_ptr> m_workers;
+        std::deque<database_op*> m_pending;
+        std::deque<completion> m_done;
+        std::vector<completion> m_reaped;
+        unsigned m_started;
+        unsigned m_ready;
+        bool m_failed;
+        bool m_stopping;
+
+    private:
+        async_pool(const async_pool&);
+        async_pool& operator = (const async_pool&);
+};
+
+#endif // kvbench_async_pool_h_
@@ -0,0 +1,181 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of this project nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <stdlib.h>
+
+// STL
+#include <coroutine>
+#include <vector>
+
+// kvbench
+#include "coroutine-clients.h"
+
+namespace
+{
+
+struct executor
+{
+    executor(database* d, void* q, client_ops* o)
+        : db(d), queue(q), ops(o), ready(), failed(false) {}
+
+    database* db;
+    void* queue;
+    client_ops* ops;
+    // clients to resume once the current poll returns
+    std::vector<std::coroutine_handle<> > ready;
+    bool failed;
+
+    private:
+        executor(const executor&);
+        executor& operator = (const executor&);
+};
+
+// A client starts suspended, and stays suspended once finished so that
+// its executor can tell it is done before destroying it.
+struct client
+{
+    struct promise_type
+    {
+        client get_return_object()
+        { return client(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return std::suspend_always(); }
+        std::suspend_always final_suspend() noexcept { return std::suspend_always(); }
+        void return_void() {}
+        void unhandled_exception() { abort(); }
+    };
+
+    explicit client(std::coroutine_handle<promise_type> h) : handle(h) {}
+    std::coroutine_handle<promise_type> handle;
+};
+
+// Awaiting a completion submits its op and suspends the client.  The
+// callback only marks the client ready: callbacks run inside submit and
+// poll, where resuming another client would submit reentrantly.
+struct completion
+{
+    completion(executor* e, database_op* o)
+        : ex(e), op(o), handle(), success(false), submitted(false) {}
+
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> h)
+    {
+        handle = h;
+        op->callback = &completion::done;
+        op->arg = this;
+        submitted = ex->db->submit(ex->queue, op);
+        ex->failed = ex->failed || !submitted;
+        return submitted;
+    }
+
+    bool await_resume() const noexcept { return submitted && success; }
+
+    static void done(database_op* op, bool success)
+    {
+        completion* c = static_cast<completion*>(op->arg);
+        c->success = success;
+        c->ex->ready.push_back(c->handle);
+    }
+
+    executor* ex;
+    database_op* op;
+    std::coroutine_handle<> handle;
+    bool success;
+    bool submitted;
+};
+
+client
+run_client(executor* ex, unsigned idx)
+{
+    database_op* op = NULL;
+
+    while (!ex->failed && (op = ex->ops->next(idx)))
+    {
+        bool again = true;
+
+        while (again)
+        {
+            bool success = co_await completion(ex, op);
+
+            if (!ex->ops->complete(idx, op, success, &again))
+            {
+                ex->failed = true;
+                co_return;
+            }
+        }
+    }
+}
+
+} // namespace
+
+bool
+run_clients(database* db, void* queue, unsigned num_clients, client_ops* ops)
+{
+    executor ex(db, queue, ops);
+    std::vector<client> clients;
+    clients.reserve(num_clients);
+
+    for (unsigned i = 0; i < num_clients; ++i)
+    {
+        clients.push_back(run_client(&ex, i));
+        ex.ready.push_back(clients.back().handle);
+    }
+
+    size_t live = clients.size();
+    bool success = true;
+
+    while (success && live > 0)
+    {
+        while (!ex.ready.empty())
+        {
+            std::coroutine_handle<> h = ex.ready.back();
+            ex.ready.pop_back();
+            h.resume();
+
+            if (h.done())
+            {
+                --live;
+            }
+        }
+
+        // every live client now waits on an op in flight
+        success = live == 0 || db->poll(queue, 1);
+    }
+
+    // after a failed poll, ops may still be in flight, and tearing down
+    // the queue may call back into the clients' frames and the executor,
+    // so both outlive it
+    success = db->teardown_async(queue) && success;
+
+    for (size_t i = 0; i < clients.size(); ++i)
+    {
+        clients[i].handle.destroy();
+    }
+
+    return success && !ex.failed;
+}
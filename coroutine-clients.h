@@ -0,0 +1,64 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of this project nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef kvbench_coroutine_clients_h_
+#define kvbench_coroutine_clients_h_
+
+// kvbench
+#include "database.h"
+
+// What each client issues; see run_clients.
+class client_ops
+{
+    public:
+        client_ops() {}
+        virtual ~client_ops() throw () {}
+
+    public:
+        // returns the client's next op, with its start stamped, or NULL
+        // once no ops remain
+        virtual database_op* next(unsigned client) = 0;
+        // called once op completes; sets *again to submit op once more
+        virtual bool complete(unsigned client, database_op* op,
+                              bool success, bool* again) = 0;
+
+    private:
+        client_ops(const client_ops&);
+        client_ops& operator = (const client_ops&);
+};
+
+// Runs num_clients clients on the calling thread until ops runs out of
+// work, issuing through a queue from database::setup_async, which it then
+// tears down.  Each client
+// is a C++20 coroutine that submits one op at a time and is suspended
+// until the op's callback, so a thread keeps as many ops in flight as it
+// has clients without blocking in any of them.  This translation unit is
+// the only one built as C++20; the interface here stays C++11.
+bool
+run_clients(database* db, void* queue, unsigned num_clients, client_ops* ops);
+
+#endif // kvbench_coroutine_clients_h_
@@ -25,10 +25,16 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+// STL
+#include <algorithm>
+#include <memory>
+
 // kvbench
+#include "async-pool.h"
 #include "database.h"
 
 database :: database()
+    : m_dl(NULL)
 {
 }
 
@@ -48,3 +54,88 @@ database :: teardown_thread(void*)
 {
     return true;
 }
+
+bool
+database :: multi_get(void* ptr, size_t num,
+                      const char* const* keys, const size_t* key_szs)
+{
+    for (size_t i = 0; i < num; ++i)
+    {
+        if (!get(ptr, keys[i], key_szs[i]))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool
+database :: multi_put(void* ptr, size_t num,
+                      const char* const* keys, const size_t* key_szs,
+                      const char* const* vals, const size_t* val_szs)
+{
+    for (size_t i = 0; i < num; ++i)
+    {
+        if (!put(ptr, keys[i], key_szs[i], vals[i], val_szs[i]))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool
+database :: setup_async(unsigned idx, void*, unsigned depth,
+                         unsigned threads, void** queue)
+{
+    std::auto_ptr<async_pool> pool(new async_pool(this, idx, std::min(depth, threads)));
+
+    if (!pool->start())
+    {
+        return false;
+    }
+
+    *queue = pool.release();
+    return true;
+}
+
+bool
+database :: submit(void* queue, database_op* op)
+{
+    return static_cast<async_pool*>(queue)->submit(op);
+}
+
+bool
+database :: poll(void* queue, unsigned min)
+{
+    return static_cast<async_pool*>(queue)->poll(min);
+}
+
+bool
+database :: teardown_async(void* queue)
+{
+    async_pool* pool = static_cast<async_pool*>(queue);
+    bool ret = pool->stop();
+    delete pool;
+    return ret;
+}
+
+const ygor_series**
+database :: series()
+{
+    return NULL;
+}
+
+size_t
+database :: series_sz()
+{
+    return 0;
+}
+
+bool
+database :: explain_stall(uint64_t, uint64_t, std::string*)
+{
+    return false;
+}
@@ -29,17 +29,41 @@
 #define kvbench_database_h_
 
 // C
+#include <stdint.h>
 #include <stdlib.h>
 
+// STL
+#include <string>
+
 // e
 #include <e/popt.h>
 
 // ygor
 #include <ygor/data.h>
 
+// One operation for the asynchronous calls.  The op, its key, and its
+// value must stay valid until its callback runs.
+struct database_op
+{
+    database_op()
+        : type('R'), key(NULL), key_sz(0), val(NULL), val_sz(0), num(0)
+        , start(0), callback(NULL), arg(NULL) {}
+
+    char type; // 'R'ead, 'W'rite, 'D'elete, or 'S'can
+    const char* key;
+    size_t key_sz;
+    const char* val;
+    size_t val_sz;
+    size_t num; // for scans
+    uint64_t start; // when the op was issued, for the callback's latency
+    void (*callback)(database_op* op, bool success);
+    void* arg;
+};
+
 class database
 {
     public:
+        // defined once by each driver plugin; see plugin.h
         static database* create();
 
     public:
@@ -62,6 +86,45 @@ class database
                          const char* val, size_t val_sz) = 0;
         virtual bool del(void* ptr, const char* key, size_t key_sz) = 0;
         virtual bool scan(void* ptr, const char* key, size_t key_sz, size_t num) = 0;
+
+    // batched calls; the defaults loop over the calls above
+    public:
+        virtual bool multi_get(void* ptr, size_t num,
+                               const char* const* keys, const size_t* key_szs);
+        virtual bool multi_put(void* ptr, size_t num,
+                               const char* const* keys, const size_t* key_szs,
+                               const char* const* vals, const size_t* val_szs);
+
+    // asynchronous calls; a thread opens a queue of up to depth ops, and
+    // each op's callback runs on that thread inside a later submit or poll.
+    // poll waits until at least min ops have completed.  The defaults hand
+    // the calls above to at most threads threads of their own, whose
+    // setup_thread indices are idx through idx + threads - 1; the caller
+    // keeps these apart from every other thread's index.  See async-pool.h
+    public:
+        virtual bool setup_async(unsigned idx, void* ptr, unsigned depth,
+                                 unsigned threads, void** queue);
+        virtual bool submit(void* queue, database_op* op);
+        virtual bool poll(void* queue, unsigned min);
+        virtual bool teardown_async(void* queue);
+
+    // series the database records alongside those of the workload
+    public:
+        virtual const ygor_series** series();
+        virtual size_t series_sz();
+        void set_data_logger(ygor_data_logger* dl) { m_dl = dl; }
+
+    // explain what the database was doing during a write stall; start and
+    // end are wallclock nanoseconds since the epoch
+    public:
+        virtual bool explain_stall(uint64_t start, uint64_t end, std::string* cause);
+
+    protected:
+        ygor_data_logger* m_dl;
+
+    private:
+        database(const database&);
+        database& operator = (const database&);
 };
 
 #endif // kvbench_database_h_
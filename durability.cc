@@ -0,0 +1,293 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of this project nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <stdio.h>
+#include <string.h>
+
+// POSIX
+#include <fcntl.h>
+#include <unistd.h>
+
+// STL
+#include <iostream>
+
+// po6
+#include <po6/time.h>
+
+// e
+#include <e/atomic.h>
+
+// kvbench
+#include "durability.h"
+
+durability :: tracker :: tracker()
+    : m_ops(0)
+    , m_last_sync(po6::monotonic_time())
+{
+}
+
+durability :: durability()
+    : m_ap()
+    , m_mode_name("none")
+    , m_fsync(false)
+    , m_every_ops(-1)
+    , m_every_ms(0)
+    , m_mode(NONE)
+    , m_series()
+    , m_dl(NULL)
+{
+    m_ap.arg().long_name("durability")
+              .description("none, fsync, fdatasync, sync_file_range, dsync, or sync (default: none)")
+              .metavar("MODE")
+              .as_string(&m_mode_name);
+    m_ap.arg().long_name("fsync")
+              .description("shorthand for --durability=fsync")
+              .set_true(&m_fsync);
+    m_ap.arg().long_name("sync-every-ops")
+              .description("sync after every N operations; 0 to disable (default: 1, or 0 if --sync-every-ms is given)")
+              .metavar("N")
+              .as_long(&m_every_ops);
+    m_ap.arg().long_name("sync-every-ms")
+              .description("sync when T milliseconds have passed since the last sync; combined with --sync-every-ops only if that is given too (default: 0)")
+              .metavar("T")
+              .as_long(&m_every_ms);
+
+    m_series.name = "sync";
+    m_series.indep_units = YGOR_UNIT_MS;
+    m_series.indep_precision = YGOR_PRECISE_INTEGER;
+    m_series.dep_units = YGOR_UNIT_MS;
+    m_series.dep_precision = YGOR_HALF_PRECISION;
+}
+
+durability :: ~durability() throw ()
+{
+}
+
+const e::argparser&
+durability :: parser()
+{
+    return m_ap;
+}
+
+const ygor_series*
+durability :: series()
+{
+    parse_mode();
+
+    switch (m_mode)
+    {
+        case FSYNC:
+        case FDATASYNC:
+        case SYNC_FILE_RANGE:
+            return &m_series;
+        case NONE:
+        case DSYNC:
+        case SYNC:
+        default:
+            return NULL;
+    }
+}
+
+bool
+durability :: setup(ygor_data_logger* dl)
+{
+    m_dl = dl;
+
+    if (!parse_mode())
+    {
+        std::cerr << "unknown durability mode \"" << m_mode_name << "\"" << std::endl;
+        return false;
+    }
+
+    // each policy stands alone unless both are given
+    if (m_every_ops == -1)
+    {
+        m_every_ops = m_every_ms > 0 ? 0 : 1;
+    }
+
+    if (m_every_ops < 0 || m_every_ms < 0)
+    {
+        std::cerr << "--sync-every-ops and --sync-every-ms must be non-negative" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+int
+durability :: open_flags() const
+{
+    switch (m_mode)
+    {
+        case DSYNC:
+            return O_DSYNC;
+        case SYNC:
+            return O_SYNC;
+        case NONE:
+        case FSYNC:
+        case FDATASYNC:
+        case SYNC_FILE_RANGE:
+        default:
+            return 0;
+    }
+}
+
+bool
+durability :: due(tracker* t, uint64_t ops)
+{
+    switch (m_mode)
+    {
+        case FSYNC:
+        case FDATASYNC:
+        case SYNC_FILE_RANGE:
+            break;
+        case NONE:
+        case DSYNC:
+        case SYNC:
+        default:
+            return false;
+    }
+
+    if (m_every_ops > 0 && ops > 0)
+    {
+        // due when the count reaches or passes a multiple of m_every_ops
+        const uint64_t count = e::atomic::increment_64_nobarrier(&t->m_ops, ops);
+
+        if (count / m_every_ops != (count - ops) / m_every_ops)
+        {
+            e::atomic::store_64_nobarrier(&t->m_last_sync, po6::monotonic_time());
+            return true;
+        }
+    }
+
+    if (m_every_ms > 0)
+    {
+        const uint64_t now = po6::monotonic_time();
+        const uint64_t last = e::atomic::load_64_nobarrier(&t->m_last_sync);
+
+        // only the thread that advances m_last_sync performs the sync
+        return now - last >= m_every_ms * PO6_MILLIS &&
+               e::atomic::compare_and_swap_64_nobarrier(&t->m_last_sync, last, now) == last;
+    }
+
+    return false;
+}
+
+bool
+durability :: sync(int fd, uint64_t off, uint64_t sz)
+{
+    const uint64_t start = po6::monotonic_time();
+    int ret = 0;
+
+    switch (m_mode)
+    {
+        case FSYNC:
+            ret = fsync(fd);
+            break;
+        case FDATASYNC:
+            ret = fdatasync(fd);
+            break;
+        case SYNC_FILE_RANGE:
+            // a sync that may cover several operations covers the whole file
+            if (m_every_ops != 1 || m_every_ms != 0)
+            {
+                off = 0;
+                sz = 0;
+            }
+
+            ret = sync_file_range(fd, off, sz, SYNC_FILE_RANGE_WAIT_BEFORE |
+                                               SYNC_FILE_RANGE_WRITE |
+                                               SYNC_FILE_RANGE_WAIT_AFTER);
+            break;
+        case NONE:
+        case DSYNC:
+        case SYNC:
+        default:
+            return true;
+    }
+
+    if (ret < 0)
+    {
+        perror("sync failed");
+        return false;
+    }
+
+    if (m_dl)
+    {
+        const uint64_t end = po6::monotonic_time();
+        ygor_data_point dp;
+        dp.series = &m_series;
+        dp.indep.precise = end / PO6_MILLIS;
+        dp.dep.approximate = (end - start) / (double)PO6_MILLIS;
+
+        if (ygor_data_logger_record(m_dl, &dp) < 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool
+durability :: parse_mode()
+{
+    const char* name = m_fsync ? "fsync" : m_mode_name;
+
+    if (strcmp(name, "none") == 0)
+    {
+        m_mode = NONE;
+    }
+    else if (strcmp(name, "fsync") == 0)
+    {
+        m_mode = FSYNC;
+    }
+    else if (strcmp(name, "fdatasync") == 0)
+    {
+        m_mode = FDATASYNC;
+    }
+    else if (strcmp(name, "sync_file_range") == 0)
+    {
+        m_mode = SYNC_FILE_RANGE;
+    }
+    else if (strcmp(name, "dsync") == 0)
+    {
+        m_mode = DSYNC;
+    }
+    else if (strcmp(name, "sync") == 0)
+    {
+        m_mode = SYNC;
+    }
+    else
+    {
+        return false;
+    }
+
+    m_series.name = name;
+    return true;
+}
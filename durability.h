@@ -0,0 +1,108 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of this project nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef kvbench_durability_h_
+#define kvbench_durability_h_
+
+// C
+#include <stdint.h>
+#include <stdlib.h>
+
+// e
+#include <e/popt.h>
+
+// ygor
+#include <ygor/data.h>
+
+// How the file drivers make their writes durable.  The mode is one of:
+//
+//  - none:             never sync
+//  - fsync:            fsync(2)
+//  - fdatasync:        fdatasync(2)
+//  - sync_file_range:  sync_file_range(2) over the bytes just written
+//  - dsync, sync:      open with O_DSYNC or O_SYNC; every write is durable
+//
+// Explicit syncs happen every --sync-every-ops operations and/or every
+// --sync-every-ms milliseconds, and the latency of each is recorded in a
+// series named after the mode.  None, dsync, and sync never sync
+// explicitly and have no series; the cost of dsync and sync shows up only
+// in the latency of the writes themselves.
+class durability
+{
+    public:
+        // per-file sync bookkeeping; one for each file descriptor
+        class tracker
+        {
+            public:
+                tracker();
+
+            private:
+                friend class durability;
+                uint64_t m_ops;
+                uint64_t m_last_sync;
+        };
+
+    public:
+        durability();
+        ~durability() throw ();
+
+    public:
+        const e::argparser& parser();
+        // NULL for the modes that never sync explicitly
+        const ygor_series* series();
+        bool setup(ygor_data_logger* dl);
+        int open_flags() const;
+
+    public:
+        // true if the caller should sync now, after ops more operations;
+        // drivers with user-space buffering flush between due() and sync()
+        bool due(tracker* t, uint64_t ops);
+        bool sync(int fd, uint64_t off, uint64_t sz);
+        bool after_write(tracker* t, int fd, uint64_t off, uint64_t sz,
+                         uint64_t ops)
+        { return !due(t, ops) || sync(fd, off, sz); }
+
+    private:
+        enum mode_t { NONE, FSYNC, FDATASYNC, SYNC_FILE_RANGE, DSYNC, SYNC };
+        bool parse_mode();
+
+    private:
+        e::argparser m_ap;
+        const char* m_mode_name;
+        bool m_fsync;
+        long m_every_ops;
+        long m_every_ms;
+        mode_t m_mode;
+        ygor_series m_series;
+        ygor_data_logger* m_dl;
+
+    private:
+        durability(const durability&);
+        durability& operator = (const durability&);
+};
+
+#endif // kvbench_durability_h_
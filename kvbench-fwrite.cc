@@ -32,12 +32,21 @@
 #include <stdio.h>
 #include <unistd.h>
 
+// POSIX
+#include <fcntl.h>
+#include <sys/stat.h>
+
+// STL
+#include <vector>
+
 // po6
 #include <po6/errno.h>
 #include <po6/threads/mutex.h>
 
 // kvbench
 #include "database.h"
+#include "durability.h"
+#include "log-segments.h"
 
 class database_fwrite : public database
 {
@@ -47,6 +56,8 @@ class database_fwrite : public database
 
     public:
         virtual const e::argparser& parser();
+        virtual const ygor_series** series();
+        virtual size_t series_sz();
         virtual bool setup(const char* prefix);
         virtual bool teardown();
 
@@ -57,11 +68,23 @@ class database_fwrite : public database
         virtual bool del(void* ptr, const char* key, size_t key_sz);
         virtual bool scan(void* ptr, const char* key, size_t key_sz, size_t num);
 
+    private:
+        bool open_segment(uint64_t idx);
+        bool roll();
+
     private:
         e::argparser m_ap;
-        bool m_fsync;
+        durability m_durable;
+        durability::tracker m_tracker;
+        log_segments m_segments;
+        const ygor_series* m_series[2];
         po6::threads::mutex m_mtx;
+        std::string m_base;
+        uint64_t m_segment;
+        uint64_t m_off;
         FILE* m_file;
+        // finished segments; other threads may still be syncing them
+        std::vector<FILE*> m_retired;
 
         database_fwrite(const database_fwrite&);
         database_fwrite& operator = (const database_fwrite&);
@@ -69,13 +92,18 @@ class database_fwrite : public database
 
 database_fwrite :: database_fwrite()
     : m_ap()
-    , m_fsync(false)
+    , m_durable()
+    , m_tracker()
+    , m_segments()
     , m_mtx()
+    , m_base()
+    , m_segment(0)
+    , m_off(0)
     , m_file(NULL)
+    , m_retired()
 {
-    m_ap.arg().long_name("fsync")
-              .description("perform an fsync after each write (default: no)")
-              .set_true(&m_fsync);
+    m_ap.add("Durability:", m_durable.parser());
+    m_ap.add("Segments:", m_segments.parser());
 }
 
 database_fwrite :: ~database_fwrite() throw ()
@@ -88,21 +116,33 @@ database_fwrite :: parser()
     return m_ap;
 }
 
+const ygor_series**
+database_fwrite :: series()
+{
+    m_series[0] = m_segments.series();
+    m_series[1] = m_durable.series();
+    return m_series;
+}
+
+size_t
+database_fwrite :: series_sz()
+{
+    return m_durable.series() ? 2 : 1;
+}
+
 bool
 database_fwrite :: setup(const char* prefix)
 {
     po6::threads::mutex::hold hold(&m_mtx);
-    std::string path = prefix;
-    path += "/file.dat";
-    m_file = fopen(path.c_str(), "w+");
 
-    if (!m_file || ferror(m_file))
+    if (!m_durable.setup(m_dl) || !m_segments.setup(m_dl))
     {
-        perror("fwrite benchmark failed");
         return false;
     }
 
-    return true;
+    m_base = prefix;
+    m_base += "/file";
+    return open_segment(0);
 }
 
 bool
@@ -116,6 +156,12 @@ database_fwrite :: teardown()
         m_file = NULL;
     }
 
+    for (size_t i = 0; i < m_retired.size(); ++i)
+    {
+        fclose(m_retired[i]);
+    }
+
+    m_retired.clear();
     return true;
 }
 
@@ -134,10 +180,17 @@ database_fwrite :: put(void* ptr,
                        const char* val, size_t val_sz)
 {
     int fd = -1;
+    uint64_t off = 0;
+    bool sync = false;
 
     {
         po6::threads::mutex::hold hold(&m_mtx);
 
+        if (m_segments.full(m_off, key_sz + val_sz) && !roll())
+        {
+            return false;
+        }
+
         if (key_sz > INT_MAX || val_sz > INT_MAX ||
             fwrite(key, 1, key_sz, m_file) != key_sz ||
             fwrite(val, 1, val_sz, m_file) != val_sz)
@@ -146,22 +199,20 @@ database_fwrite :: put(void* ptr,
             return false;
         }
 
-        if (m_fsync && fflush(m_file))
+        sync = m_durable.due(&m_tracker, 1);
+
+        if (sync && fflush(m_file))
         {
             perror("fwrite benchmark failed");
             return false;
         }
 
         fd = fileno(m_file);
+        off = m_off;
+        m_off += key_sz + val_sz;
     }
 
-    if (m_fsync && fsync(fd) < 0)
-    {
-        perror("fwrite benchmark failed");
-        return false;
-    }
-
-    return true;
+    return !sync || m_durable.sync(fd, off, key_sz + val_sz);
     (void) ptr;
 }
 
@@ -184,6 +235,59 @@ database_fwrite :: scan(void* ptr, const char* key, size_t key_sz, size_t num)
     (void) num;
 }
 
+// Called with m_mtx held, or during setup.
+bool
+database_fwrite :: open_segment(uint64_t idx)
+{
+    int fd = -1;
+
+    if (!m_segments.open_segment(m_base, idx, m_durable.open_flags(), &fd))
+    {
+        return false;
+    }
+
+    FILE* file = fdopen(fd, "w+");
+
+    if (!file || ferror(file))
+    {
+        perror("fwrite benchmark failed");
+
+        if (file)
+        {
+            fclose(file);
+        }
+        else
+        {
+            close(fd);
+        }
+
+        return false;
+    }
+
+    if (m_file)
+    {
+        m_retired.push_back(m_file);
+    }
+
+    m_file = file;
+    m_segment = idx;
+    m_off = 0;
+    return true;
+}
+
+// Called with m_mtx held.
+bool
+database_fwrite :: roll()
+{
+    if (fflush(m_file))
+    {
+        perror("fwrite benchmark failed");
+        return false;
+    }
+
+    return open_segment(m_segment + 1);
+}
+
 database*
 database::create()
 {
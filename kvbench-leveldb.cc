@@ -28,18 +28,32 @@
 #define __STDC_LIMIT_MACROS
 
 // C
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 // STL
-#include <memory>
+#include <algorithm>
+#include <fstream>
+#include <vector>
+
+// po6
+#include <po6/threads/mutex.h>
+#include <po6/time.h>
 
 // LevelDB
+#include <leveldb/cache.h>
 #include <leveldb/comparator.h>
 #include <leveldb/db.h>
 #include <leveldb/filter_policy.h>
+#include <leveldb/write_batch.h>
 
 // kvbench
+#include "allocations.h"
 #include "database.h"
+#include "hash.h"
+#include "leveldb-stats.h"
 
 class database_leveldb : public database
 {
@@ -49,7 +63,11 @@ class database_leveldb : public database
 
     public:
         virtual const e::argparser& parser();
+        virtual const ygor_series** series();
+        virtual size_t series_sz();
         virtual bool setup(const char* prefix);
+        virtual bool setup_thread(unsigned idx, void** ptr);
+        virtual bool teardown_thread(void* ptr);
         virtual bool teardown();
 
         virtual bool get(void* ptr, const char* key, size_t key_sz);
@@ -59,20 +77,176 @@ class database_leveldb : public database
         virtual bool del(void* ptr, const char* key, size_t key_sz);
         virtual bool scan(void* ptr, const char* key, size_t key_sz, size_t num);
 
+        virtual bool multi_put(void* ptr, size_t num,
+                               const char* const* keys, const size_t* key_szs,
+                               const char* const* vals, const size_t* val_szs);
+        virtual bool explain_stall(uint64_t start, uint64_t end, std::string* cause);
+
+    private:
+        typedef std::pair<uint64_t, std::string> log_event;
+        struct instance_state;
+        struct thread_state;
+        class op_scope;
+        size_t route(thread_state* ts, const char* key, size_t key_sz);
+        bool batching() const { return m_batch_ops > 0 || m_batch_us > 0; }
+        bool batch_due(instance_state* is, uint64_t now);
+        bool commit(thread_state* ts, size_t idx);
+        void load_log();
+
     private:
         e::argparser m_ap;
+        long m_block_cache;
+        long m_write_buffer_size;
+        long m_block_size;
+        bool m_compression;
+        long m_bloom_bits;
+        bool m_paranoid_checks;
+        bool m_sync;
+        long m_batch_ops;
+        long m_batch_us;
+        bool m_pool_iterators;
+        bool m_count_allocs;
+        long m_instances;
+        bool m_pin_threads;
+        leveldb_stats m_stats;
+        ygor_series m_series;
+        std::vector<const ygor_series*> m_series_ptrs;
+        leveldb::Cache* m_cache;
         const leveldb::FilterPolicy* m_bf;
-        leveldb::DB* m_db;
+        std::vector<std::string> m_names;
+        std::vector<leveldb::DB*> m_dbs;
+        bool m_log_loaded;
+        std::vector<log_event> m_log;
+        po6::threads::mutex m_mtx;
+        uint64_t m_ops;
+        uint64_t m_allocs;
 
         database_leveldb(const database_leveldb&);
         database_leveldb& operator = (const database_leveldb&);
 };
 
+// A thread's state for one LevelDB instance.  With batching enabled, puts
+// and deletes accumulate in "batch" until it is committed; "enqueued" holds
+// the time each operation was added.  With --pool-iterators, "it" is
+// created by the first scan and reused.
+struct database_leveldb::instance_state
+{
+    instance_state() : batch(), enqueued(), it(NULL) {}
+
+    leveldb::WriteBatch batch;
+    std::vector<uint64_t> enqueued;
+    leveldb::Iterator* it;
+};
+
+// Everything an operation needs is reused across calls.
+struct database_leveldb::thread_state
+{
+    thread_state(unsigned i, size_t n)
+        : idx(i), ropts(), wopts(), value(), instances(n)
+        , ops(0), allocs(0) {}
+
+    unsigned idx;
+    leveldb::ReadOptions ropts;
+    leveldb::WriteOptions wopts;
+    std::string value;
+    std::vector<instance_state> instances;
+    uint64_t ops;
+    uint64_t allocs;
+
+    private:
+        thread_state(const thread_state&);
+        thread_state& operator = (const thread_state&);
+};
+
+// Charges the allocations made during one operation to its thread.
+class database_leveldb::op_scope
+{
+    public:
+        op_scope(thread_state* ts) : m_ts(ts), m_start(kvbench_thread_allocations()) {}
+        ~op_scope() throw () { ++m_ts->ops; m_ts->allocs += kvbench_thread_allocations() - m_start; }
+
+    private:
+        thread_state* m_ts;
+        uint64_t m_start;
+
+        op_scope(const op_scope&);
+        op_scope& operator = (const op_scope&);
+};
+
 database_leveldb :: database_leveldb()
     : m_ap()
+    , m_block_cache(8)
+    , m_write_buffer_size(4)
+    , m_block_size(4096)
+    , m_compression(true)
+    , m_bloom_bits(10)
+    , m_paranoid_checks(false)
+    , m_sync(false)
+    , m_batch_ops(0)
+    , m_batch_us(0)
+    , m_pool_iterators(false)
+    , m_count_allocs(false)
+    , m_instances(1)
+    , m_pin_threads(false)
+    , m_stats()
+    , m_series()
+    , m_series_ptrs()
+    , m_cache(NULL)
     , m_bf(NULL)
-    , m_db(NULL)
+    , m_names()
+    , m_dbs()
+    , m_log_loaded(false)
+    , m_log()
+    , m_mtx()
+    , m_ops(0)
+    , m_allocs(0)
 {
+    m_ap.arg().long_name("block-cache")
+              .description("size of the block cache in MB (default: 8)")
+              .metavar("MB").as_long(&m_block_cache);
+    m_ap.arg().long_name("write-buffer-size")
+              .description("size of the memtable in MB (default: 4)")
+              .metavar("MB").as_long(&m_write_buffer_size);
+    m_ap.arg().long_name("block-size")
+              .description("approximate size of uncompressed table blocks in bytes (default: 4096)")
+              .metavar("BYTES").as_long(&m_block_size);
+    m_ap.arg().long_name("no-compression")
+              .description("do not compress table blocks (default: snappy)")
+              .set_false(&m_compression);
+    m_ap.arg().long_name("bloom-bits")
+              .description("bloom filter bits per key; 0 disables filters (default: 10)")
+              .metavar("N").as_long(&m_bloom_bits);
+    m_ap.arg().long_name("paranoid-checks")
+              .description("aggressively check data for corruption (default: no)")
+              .set_true(&m_paranoid_checks);
+    m_ap.arg().long_name("sync")
+              .description("sync the log on every write (default: no)")
+              .set_true(&m_sync);
+    m_ap.arg().long_name("batch-ops")
+              .description("commit each thread's writes in batches of N operations (default: 0, unbatched)")
+              .metavar("N").as_long(&m_batch_ops);
+    m_ap.arg().long_name("batch-us")
+              .description("commit a thread's batch once its oldest write is T microseconds old (default: 0)")
+              .metavar("T").as_long(&m_batch_us);
+    m_ap.arg().long_name("pool-iterators")
+              .description("reuse one iterator per thread for scans; it sees the database as of its first scan (default: no)")
+              .set_true(&m_pool_iterators);
+    m_ap.arg().long_name("count-allocs")
+              .description("report heap allocations per operation at teardown (default: no)")
+              .set_true(&m_count_allocs);
+    m_ap.arg().long_name("instances")
+              .description("open N independent databases and route keys among them by hash (default: 1)")
+              .metavar("N").as_long(&m_instances);
+    m_ap.arg().long_name("pin-threads")
+              .description("send all of thread i's operations to instance i % N instead of routing by key (default: no)")
+              .set_true(&m_pin_threads);
+    m_ap.add("Statistics:", m_stats.parser());
+
+    m_series.name = "batched-write";
+    m_series.indep_units = YGOR_UNIT_MS;
+    m_series.indep_precision = YGOR_PRECISE_INTEGER;
+    m_series.dep_units = YGOR_UNIT_MS;
+    m_series.dep_precision = YGOR_HALF_PRECISION;
 }
 
 database_leveldb :: ~database_leveldb() throw ()
@@ -85,40 +259,187 @@ database_leveldb :: parser()
     return m_ap;
 }
 
+const ygor_series**
+database_leveldb :: series()
+{
+    if (m_series_ptrs.empty())
+    {
+        if (batching())
+        {
+            m_series_ptrs.push_back(&m_series);
+        }
+
+        m_series_ptrs.insert(m_series_ptrs.end(), m_stats.series(),
+                             m_stats.series() + m_stats.series_sz());
+    }
+
+    return m_series_ptrs.empty() ? NULL : &m_series_ptrs[0];
+}
+
+size_t
+database_leveldb :: series_sz()
+{
+    return (batching() ? 1 : 0) + m_stats.series_sz();
+}
+
 bool
 database_leveldb :: setup(const char* prefix)
 {
+    if (m_block_cache <= 0 || m_write_buffer_size <= 0 ||
+        m_block_size <= 0 || m_bloom_bits < 0)
+    {
+        std::cerr << "leveldb sizes must be positive" << std::endl;
+        return false;
+    }
+
+    if (m_batch_ops < 0 || m_batch_us < 0)
+    {
+        std::cerr << "--batch-ops and --batch-us must be non-negative" << std::endl;
+        return false;
+    }
+
+    if (m_instances < 1)
+    {
+        std::cerr << "--instances must be positive" << std::endl;
+        return false;
+    }
+
     leveldb::Options opts;
     opts.create_if_missing = true;
-    opts.filter_policy = m_bf = leveldb::NewBloomFilterPolicy(10);
-    opts.max_open_files = std::max(sysconf(_SC_OPEN_MAX) >> 1, 1024L);
-    leveldb::Status st = leveldb::DB::Open(opts, prefix, &m_db);
+    opts.paranoid_checks = m_paranoid_checks;
+    opts.block_cache = m_cache = leveldb::NewLRUCache(m_block_cache * 1024ULL * 1024ULL);
+    opts.write_buffer_size = m_write_buffer_size * 1024ULL * 1024ULL;
+    opts.block_size = m_block_size;
+    opts.compression = m_compression ? leveldb::kSnappyCompression : leveldb::kNoCompression;
 
-    if (!st.ok())
+    if (m_bloom_bits > 0)
     {
-        std::cerr << "could not open LevelDB: " << st.ToString() << std::endl;
-        return false;
+        opts.filter_policy = m_bf = leveldb::NewBloomFilterPolicy(m_bloom_bits);
     }
 
+    // instances share the cache, the filter policy and the fd budget
+    opts.max_open_files = std::max(sysconf(_SC_OPEN_MAX) >> 1, 1024L) / m_instances;
+
+    for (long i = 0; i < m_instances; ++i)
+    {
+        std::string name(prefix);
+
+        if (m_instances > 1)
+        {
+            char buf[32];
+            snprintf(buf, sizeof(buf), "/instance-%03ld", i);
+            name += buf;
+        }
+
+        leveldb::DB* db = NULL;
+        leveldb::Status st = leveldb::DB::Open(opts, name, &db);
+
+        if (!st.ok())
+        {
+            std::cerr << "could not open LevelDB: " << st.ToString() << std::endl;
+            return false;
+        }
+
+        m_names.push_back(name);
+        m_dbs.push_back(db);
+    }
+
+    return m_stats.setup(m_dl, m_dbs);
+}
+
+bool
+database_leveldb :: setup_thread(unsigned idx, void** ptr)
+{
+    thread_state* ts = new thread_state(idx, m_dbs.size());
+    ts->wopts.sync = m_sync;
+    ts->value.reserve(4096);
+
+    for (size_t i = 0; i < ts->instances.size(); ++i)
+    {
+        ts->instances[i].enqueued.reserve(m_batch_ops > 0 ? m_batch_ops : 0);
+    }
+
+    *ptr = ts;
     return true;
 }
 
+bool
+database_leveldb :: teardown_thread(void* ptr)
+{
+    thread_state* ts = static_cast<thread_state*>(ptr);
+
+    if (!ts)
+    {
+        return true;
+    }
+
+    bool ret = true;
+
+    for (size_t i = 0; i < ts->instances.size(); ++i)
+    {
+        instance_state* is = &ts->instances[i];
+
+        if (!is->enqueued.empty() && !commit(ts, i))
+        {
+            ret = false;
+        }
+
+        if (is->it)
+        {
+            delete is->it;
+        }
+    }
+
+    {
+        po6::threads::mutex::hold hold(&m_mtx);
+        m_ops += ts->ops;
+        m_allocs += ts->allocs;
+    }
+
+    delete ts;
+    return ret;
+}
+
 bool
 database_leveldb :: teardown()
 {
-    if (m_db)
+    bool ret = m_stats.teardown();
+
+    if (m_count_allocs)
     {
-        delete m_db;
+        po6::threads::mutex::hold hold(&m_mtx);
+        std::cerr << "leveldb: " << m_allocs << " allocations in "
+                  << m_ops << " operations ("
+                  << (m_ops ? (double)m_allocs / m_ops : 0.) << " per operation)" << std::endl;
     }
 
-    return true;
+    for (size_t i = 0; i < m_dbs.size(); ++i)
+    {
+        delete m_dbs[i];
+    }
+
+    m_dbs.clear();
+
+    if (m_bf)
+    {
+        delete m_bf;
+    }
+
+    if (m_cache)
+    {
+        delete m_cache;
+    }
+
+    return ret;
 }
 
 bool
-database_leveldb :: get(void*, const char* key, size_t key_sz)
+database_leveldb :: get(void* ptr, const char* key, size_t key_sz)
 {
-    std::string value;
-    leveldb::Status st = m_db->Get(leveldb::ReadOptions(), leveldb::Slice(key, key_sz), &value);
+    thread_state* ts = static_cast<thread_state*>(ptr);
+    op_scope scope(ts);
+    leveldb::DB* db = m_dbs[route(ts, key, key_sz)];
+    leveldb::Status st = db->Get(ts->ropts, leveldb::Slice(key, key_sz), &ts->value);
 
     if (!st.ok() && !st.IsNotFound())
     {
@@ -130,13 +451,25 @@ database_leveldb :: get(void*, const char* key, size_t key_sz)
 }
 
 bool
-database_leveldb :: put(void*,
+database_leveldb :: put(void* ptr,
                        const char* key, size_t key_sz,
                        const char* val, size_t val_sz)
 {
-    leveldb::WriteOptions opts;
-    opts.sync = false;
-    leveldb::Status st = m_db->Put(opts, leveldb::Slice(key, key_sz), leveldb::Slice(val, val_sz));
+    thread_state* ts = static_cast<thread_state*>(ptr);
+    op_scope scope(ts);
+
+    const size_t idx = route(ts, key, key_sz);
+
+    if (batching())
+    {
+        instance_state* is = &ts->instances[idx];
+        const uint64_t now = po6::monotonic_time();
+        is->batch.Put(leveldb::Slice(key, key_sz), leveldb::Slice(val, val_sz));
+        is->enqueued.push_back(now);
+        return !batch_due(is, now) || commit(ts, idx);
+    }
+
+    leveldb::Status st = m_dbs[idx]->Put(ts->wopts, leveldb::Slice(key, key_sz), leveldb::Slice(val, val_sz));
 
     if (!st.ok())
     {
@@ -148,11 +481,23 @@ database_leveldb :: put(void*,
 }
 
 bool
-database_leveldb :: del(void*, const char* key, size_t key_sz)
+database_leveldb :: del(void* ptr, const char* key, size_t key_sz)
 {
-    leveldb::WriteOptions opts;
-    opts.sync = false;
-    leveldb::Status st = m_db->Delete(opts, leveldb::Slice(key, key_sz));
+    thread_state* ts = static_cast<thread_state*>(ptr);
+    op_scope scope(ts);
+
+    const size_t idx = route(ts, key, key_sz);
+
+    if (batching())
+    {
+        instance_state* is = &ts->instances[idx];
+        const uint64_t now = po6::monotonic_time();
+        is->batch.Delete(leveldb::Slice(key, key_sz));
+        is->enqueued.push_back(now);
+        return !batch_due(is, now) || commit(ts, idx);
+    }
+
+    leveldb::Status st = m_dbs[idx]->Delete(ts->wopts, leveldb::Slice(key, key_sz));
 
     if (!st.ok() && !st.IsNotFound())
     {
@@ -163,23 +508,276 @@ database_leveldb :: del(void*, const char* key, size_t key_sz)
     return true;
 }
 
+// Each instance gets one WriteBatch holding the keys routed to it.  With
+// --batch-ops or --batch-us the puts join the pending batches instead.
+bool
+database_leveldb :: multi_put(void* ptr, size_t num,
+                             const char* const* keys, const size_t* key_szs,
+                             const char* const* vals, const size_t* val_szs)
+{
+    if (batching())
+    {
+        return database::multi_put(ptr, num, keys, key_szs, vals, val_szs);
+    }
+
+    thread_state* ts = static_cast<thread_state*>(ptr);
+    op_scope scope(ts);
+    ts->ops += num - 1;
+
+    for (size_t idx = 0; idx < ts->instances.size(); ++idx)
+    {
+        instance_state* is = &ts->instances[idx];
+        size_t added = 0;
+
+        for (size_t i = 0; i < num; ++i)
+        {
+            if (route(ts, keys[i], key_szs[i]) == idx)
+            {
+                is->batch.Put(leveldb::Slice(keys[i], key_szs[i]),
+                              leveldb::Slice(vals[i], val_szs[i]));
+                ++added;
+            }
+        }
+
+        if (added == 0)
+        {
+            continue;
+        }
+
+        leveldb::Status st = m_dbs[idx]->Write(ts->wopts, &is->batch);
+        is->batch.Clear();
+
+        if (!st.ok())
+        {
+            std::cerr << "leveldb error: " << st.ToString() << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Keys routed by hash may live in any instance, so the scan merges an
+// iterator from each; a pinned thread only scans its own instance.
+bool
+database_leveldb :: scan(void* ptr, const char* key, size_t key_sz, size_t num)
+{
+    thread_state* ts = static_cast<thread_state*>(ptr);
+    op_scope scope(ts);
+    const size_t first = m_pin_threads ? route(ts, key, key_sz) : 0;
+    const size_t limit = m_pin_threads ? first + 1 : m_dbs.size();
+
+    for (size_t i = first; i < limit; ++i)
+    {
+        instance_state* is = &ts->instances[i];
+
+        if (!is->it)
+        {
+            is->it = m_dbs[i]->NewIterator(ts->ropts);
+        }
+
+        is->it->Seek(leveldb::Slice(key, key_sz));
+    }
+
+    for (size_t n = 0; n < num; ++n)
+    {
+        leveldb::Iterator* min = NULL;
+
+        for (size_t i = first; i < limit; ++i)
+        {
+            leveldb::Iterator* it = ts->instances[i].it;
+
+            if (it->Valid() && (!min || it->key().compare(min->key()) < 0))
+            {
+                min = it;
+            }
+        }
+
+        if (!min)
+        {
+            break;
+        }
+
+        min->Next();
+    }
+
+    bool ret = true;
+
+    for (size_t i = first; i < limit; ++i)
+    {
+        instance_state* is = &ts->instances[i];
+
+        if (!is->it->status().ok())
+        {
+            std::cerr << "leveldb error: " << is->it->status().ToString() << std::endl;
+            ret = false;
+        }
+
+        if (!m_pool_iterators)
+        {
+            delete is->it;
+            is->it = NULL;
+        }
+    }
+
+    return ret;
+}
+
+// LevelDB's info LOG notes when it flushes memtables, compacts, and makes
+// writers wait.  A stall is explained by the events logged during it and
+// the last event logged before it, which is usually the work still in
+// progress when it began.
 bool
-database_leveldb :: scan(void*, const char* key, size_t key_sz, size_t num)
+database_leveldb :: explain_stall(uint64_t start, uint64_t end, std::string* cause)
+{
+    if (!m_log_loaded)
+    {
+        load_log();
+        m_log_loaded = true;
+    }
+
+    size_t idx = std::lower_bound(m_log.begin(), m_log.end(),
+                                  log_event(start, std::string())) - m_log.begin();
+    idx = idx > 0 ? idx - 1 : 0;
+    cause->clear();
+
+    for (size_t n = 0; idx < m_log.size() && m_log[idx].first <= end; ++idx, ++n)
+    {
+        if (n == 8)
+        {
+            *cause += "; ...";
+            break;
+        }
+
+        if (!cause->empty())
+        {
+            *cause += "; ";
+        }
+
+        *cause += m_log[idx].second;
+    }
+
+    return !cause->empty();
+}
+
+void
+database_leveldb :: load_log()
+{
+    static const char* interesting[] = {
+        "Compacting", "Compacted", "Level-0 table",
+        "Current memtable full", "Too many L0 files"
+    };
+
+    for (size_t i = 0; i < m_names.size(); ++i)
+    {
+        std::ifstream in((m_names[i] + "/LOG").c_str());
+        std::string line;
+
+        // "YYYY/MM/DD-HH:MM:SS.UUUUUU <thread> <message>" in local time
+        while (std::getline(in, line))
+        {
+            struct tm t;
+            long usec = 0;
+            int consumed = 0;
+            memset(&t, 0, sizeof(t));
+
+            if (sscanf(line.c_str(), "%d/%d/%d-%d:%d:%d.%ld %*s %n",
+                       &t.tm_year, &t.tm_mon, &t.tm_mday,
+                       &t.tm_hour, &t.tm_min, &t.tm_sec, &usec, &consumed) != 7 ||
+                consumed == 0)
+            {
+                continue;
+            }
+
+            const char* msg = line.c_str() + consumed;
+            bool keep = false;
+
+            for (size_t j = 0; j < sizeof(interesting) / sizeof(interesting[0]); ++j)
+            {
+                keep = keep || strncmp(msg, interesting[j], strlen(interesting[j])) == 0;
+            }
+
+            if (!keep)
+            {
+                continue;
+            }
+
+            t.tm_year -= 1900;
+            t.tm_mon -= 1;
+            t.tm_isdst = -1;
+            const uint64_t when = mktime(&t) * PO6_SECONDS + usec * PO6_MICROS;
+            std::string what(msg);
+
+            if (m_names.size() > 1)
+            {
+                what = m_names[i].substr(m_names[i].rfind('/') + 1) + ": " + what;
+            }
+
+            m_log.push_back(log_event(when, what));
+        }
+    }
+
+    std::sort(m_log.begin(), m_log.end());
+}
+
+size_t
+database_leveldb :: route(thread_state* ts, const char* key, size_t key_sz)
 {
-    std::auto_ptr<leveldb::Iterator> it(m_db->NewIterator(leveldb::ReadOptions()));
-    it->Seek(leveldb::Slice(key, key_sz));
+    if (m_dbs.size() == 1)
+    {
+        return 0;
+    }
 
-    for (size_t i = 0; i < num && it->Valid(); ++i)
+    if (m_pin_threads)
     {
-        it->Next();
+        return ts->idx % m_dbs.size();
     }
 
-    if (!it->status().ok())
+    return kvbench_hash(key, key_sz) % m_dbs.size();
+}
+
+// The time limit is only checked as operations arrive, so an idle thread
+// holds its batch until its next write or teardown.
+bool
+database_leveldb :: batch_due(instance_state* is, uint64_t now)
+{
+    if (m_batch_ops > 0 && is->enqueued.size() >= (size_t)m_batch_ops)
     {
-        std::cerr << "leveldb error: " << it->status().ToString() << std::endl;
+        return true;
+    }
+
+    return m_batch_us > 0 && now - is->enqueued.front() >= m_batch_us * PO6_MICROS;
+}
+
+bool
+database_leveldb :: commit(thread_state* ts, size_t idx)
+{
+    instance_state* is = &ts->instances[idx];
+    leveldb::Status st = m_dbs[idx]->Write(ts->wopts, &is->batch);
+
+    if (!st.ok())
+    {
+        std::cerr << "leveldb error: " << st.ToString() << std::endl;
         return false;
     }
 
+    const uint64_t end = po6::monotonic_time();
+
+    for (size_t i = 0; m_dl && i < is->enqueued.size(); ++i)
+    {
+        ygor_data_point dp;
+        dp.series = &m_series;
+        dp.indep.precise = end / PO6_MILLIS;
+        dp.dep.approximate = (end - is->enqueued[i]) / (double)PO6_MILLIS;
+
+        if (ygor_data_logger_record(m_dl, &dp) < 0)
+        {
+            return false;
+        }
+    }
+
+    is->batch.Clear();
+    is->enqueued.clear();
     return true;
 }
 
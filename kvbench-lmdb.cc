@@ -0,0 +1,416 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of this project nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <stdint.h>
+
+// STL
+#include <string>
+
+// LMDB
+#include <lmdb.h>
+
+// kvbench
+#include "database.h"
+
+class database_lmdb : public database
+{
+    public:
+        database_lmdb();
+        ~database_lmdb() throw ();
+
+    public:
+        virtual const e::argparser& parser();
+        virtual bool setup(const char* prefix);
+        virtual bool setup_thread(unsigned idx, void** ptr);
+        virtual bool teardown_thread(void* ptr);
+        virtual bool teardown();
+
+        virtual bool get(void* ptr, const char* key, size_t key_sz);
+        virtual bool put(void* ptr,
+                         const char* key, size_t key_sz,
+                         const char* val, size_t val_sz);
+        virtual bool del(void* ptr, const char* key, size_t key_sz);
+        virtual bool scan(void* ptr, const char* key, size_t key_sz, size_t num);
+
+    private:
+        struct thread_state;
+        bool begin_read(thread_state* ts, MDB_txn** txn);
+        void end_read(MDB_txn* txn);
+        bool error(const char* what, int rc);
+
+    private:
+        e::argparser m_ap;
+        long m_map_size;
+        bool m_nosync;
+        bool m_writemap;
+        bool m_reuse_txns;
+        MDB_env* m_env;
+        MDB_dbi m_dbi;
+
+        database_lmdb(const database_lmdb&);
+        database_lmdb& operator = (const database_lmdb&);
+};
+
+// With --reuse-read-txns, each thread keeps one read transaction and one
+// cursor, resetting and renewing them instead of creating new ones.
+struct database_lmdb::thread_state
+{
+    thread_state() : txn(NULL), cursor(NULL), value() {}
+
+    MDB_txn* txn;
+    MDB_cursor* cursor;
+    std::string value;
+
+    private:
+        thread_state(const thread_state&);
+        thread_state& operator = (const thread_state&);
+};
+
+database_lmdb :: database_lmdb()
+    : m_ap()
+    , m_map_size(1024)
+    , m_nosync(false)
+    , m_writemap(false)
+    , m_reuse_txns(false)
+    , m_env(NULL)
+    , m_dbi(0)
+{
+    m_ap.arg().long_name("map-size")
+              .description("size of the memory map, and so the largest the database may grow, in MB (default: 1024)")
+              .metavar("MB").as_long(&m_map_size);
+    m_ap.arg().long_name("nosync")
+              .description("do not sync when committing transactions (MDB_NOSYNC) (default: no)")
+              .set_true(&m_nosync);
+    m_ap.arg().long_name("writemap")
+              .description("write through a writable memory map (MDB_WRITEMAP) (default: no)")
+              .set_true(&m_writemap);
+    m_ap.arg().long_name("reuse-read-txns")
+              .description("reset and renew one read transaction per thread (default: no)")
+              .set_true(&m_reuse_txns);
+}
+
+database_lmdb :: ~database_lmdb() throw ()
+{
+}
+
+const e::argparser&
+database_lmdb :: parser()
+{
+    return m_ap;
+}
+
+bool
+database_lmdb :: setup(const char* prefix)
+{
+    if (m_map_size <= 0)
+    {
+        std::cerr << "--map-size must be positive" << std::endl;
+        return false;
+    }
+
+    unsigned flags = MDB_NOTLS;
+    flags |= m_nosync ? MDB_NOSYNC : 0;
+    flags |= m_writemap ? MDB_WRITEMAP : 0;
+    int rc = 0;
+
+    if ((rc = mdb_env_create(&m_env)) != 0 ||
+        (rc = mdb_env_set_mapsize(m_env, m_map_size * 1024ULL * 1024ULL)) != 0 ||
+        (rc = mdb_env_set_maxreaders(m_env, 1024)) != 0 ||
+        (rc = mdb_env_open(m_env, prefix, flags, 0644)) != 0)
+    {
+        return error("could not open LMDB", rc);
+    }
+
+    MDB_txn* txn = NULL;
+
+    if ((rc = mdb_txn_begin(m_env, NULL, 0, &txn)) != 0)
+    {
+        return error("could not open LMDB", rc);
+    }
+
+    if ((rc = mdb_dbi_open(txn, NULL, 0, &m_dbi)) != 0)
+    {
+        mdb_txn_abort(txn);
+        return error("could not open LMDB", rc);
+    }
+
+    if ((rc = mdb_txn_commit(txn)) != 0)
+    {
+        return error("could not open LMDB", rc);
+    }
+
+    return true;
+}
+
+bool
+database_lmdb :: setup_thread(unsigned, void** ptr)
+{
+    *ptr = new thread_state();
+    return true;
+}
+
+bool
+database_lmdb :: teardown_thread(void* ptr)
+{
+    thread_state* ts = static_cast<thread_state*>(ptr);
+
+    if (!ts)
+    {
+        return true;
+    }
+
+    if (ts->cursor)
+    {
+        mdb_cursor_close(ts->cursor);
+    }
+
+    if (ts->txn)
+    {
+        mdb_txn_abort(ts->txn);
+    }
+
+    delete ts;
+    return true;
+}
+
+bool
+database_lmdb :: teardown()
+{
+    if (m_env)
+    {
+        mdb_dbi_close(m_env, m_dbi);
+        mdb_env_close(m_env);
+        m_env = NULL;
+    }
+
+    return true;
+}
+
+bool
+database_lmdb :: get(void* ptr, const char* key, size_t key_sz)
+{
+    thread_state* ts = static_cast<thread_state*>(ptr);
+    MDB_txn* txn = NULL;
+
+    if (!begin_read(ts, &txn))
+    {
+        return false;
+    }
+
+    MDB_val k;
+    k.mv_size = key_sz;
+    k.mv_data = const_cast<char*>(key);
+    MDB_val v;
+    int rc = mdb_get(txn, m_dbi, &k, &v);
+
+    if (rc == 0)
+    {
+        ts->value.assign(static_cast<const char*>(v.mv_data), v.mv_size);
+    }
+
+    end_read(txn);
+    return rc == 0 || rc == MDB_NOTFOUND || error("lmdb error", rc);
+}
+
+bool
+database_lmdb :: put(void*,
+                     const char* key, size_t key_sz,
+                     const char* val, size_t val_sz)
+{
+    MDB_txn* txn = NULL;
+    int rc = mdb_txn_begin(m_env, NULL, 0, &txn);
+
+    if (rc != 0)
+    {
+        return error("lmdb error", rc);
+    }
+
+    MDB_val k;
+    k.mv_size = key_sz;
+    k.mv_data = const_cast<char*>(key);
+    MDB_val v;
+    v.mv_size = val_sz;
+    v.mv_data = const_cast<char*>(val);
+
+    if ((rc = mdb_put(txn, m_dbi, &k, &v, 0)) != 0)
+    {
+        mdb_txn_abort(txn);
+        return error("lmdb error", rc);
+    }
+
+    if ((rc = mdb_txn_commit(txn)) != 0)
+    {
+        return error("lmdb error", rc);
+    }
+
+    return true;
+}
+
+bool
+database_lmdb :: del(void*, const char* key, size_t key_sz)
+{
+    MDB_txn* txn = NULL;
+    int rc = mdb_txn_begin(m_env, NULL, 0, &txn);
+
+    if (rc != 0)
+    {
+        return error("lmdb error", rc);
+    }
+
+    MDB_val k;
+    k.mv_size = key_sz;
+    k.mv_data = const_cast<char*>(key);
+    rc = mdb_del(txn, m_dbi, &k, NULL);
+
+    if (rc == MDB_NOTFOUND)
+    {
+        mdb_txn_abort(txn);
+        return true;
+    }
+
+    if (rc != 0)
+    {
+        mdb_txn_abort(txn);
+        return error("lmdb error", rc);
+    }
+
+    if ((rc = mdb_txn_commit(txn)) != 0)
+    {
+        return error("lmdb error", rc);
+    }
+
+    return true;
+}
+
+bool
+database_lmdb :: scan(void* ptr, const char* key, size_t key_sz, size_t num)
+{
+    thread_state* ts = static_cast<thread_state*>(ptr);
+    MDB_txn* txn = NULL;
+
+    if (!begin_read(ts, &txn))
+    {
+        return false;
+    }
+
+    MDB_cursor* cursor = NULL;
+    int rc = 0;
+
+    if (m_reuse_txns && ts->cursor)
+    {
+        cursor = ts->cursor;
+        rc = mdb_cursor_renew(txn, cursor);
+    }
+    else
+    {
+        rc = mdb_cursor_open(txn, m_dbi, &cursor);
+    }
+
+    if (rc != 0)
+    {
+        end_read(txn);
+        return error("lmdb error", rc);
+    }
+
+    MDB_val k;
+    k.mv_size = key_sz;
+    k.mv_data = const_cast<char*>(key);
+    MDB_val v;
+    rc = mdb_cursor_get(cursor, &k, &v, MDB_SET_RANGE);
+
+    for (size_t i = 1; rc == 0 && i < num; ++i)
+    {
+        rc = mdb_cursor_get(cursor, &k, &v, MDB_NEXT);
+    }
+
+    if (m_reuse_txns)
+    {
+        ts->cursor = cursor;
+    }
+    else
+    {
+        mdb_cursor_close(cursor);
+    }
+
+    end_read(txn);
+    return rc == 0 || rc == MDB_NOTFOUND || error("lmdb error", rc);
+}
+
+bool
+database_lmdb :: begin_read(thread_state* ts, MDB_txn** txn)
+{
+    int rc = 0;
+
+    if (m_reuse_txns && ts->txn)
+    {
+        *txn = ts->txn;
+        rc = mdb_txn_renew(ts->txn);
+    }
+    else
+    {
+        rc = mdb_txn_begin(m_env, NULL, MDB_RDONLY, txn);
+    }
+
+    if (rc != 0)
+    {
+        return error("lmdb error", rc);
+    }
+
+    if (m_reuse_txns)
+    {
+        ts->txn = *txn;
+    }
+
+    return true;
+}
+
+void
+database_lmdb :: end_read(MDB_txn* txn)
+{
+    if (m_reuse_txns)
+    {
+        mdb_txn_reset(txn);
+    }
+    else
+    {
+        mdb_txn_abort(txn);
+    }
+}
+
+bool
+database_lmdb :: error(const char* what, int rc)
+{
+    std::cerr << what << ": " << mdb_strerror(rc) << std::endl;
+    return false;
+}
+
+database*
+database::create()
+{
+    return new database_lmdb();
+}
@@ -0,0 +1,462 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of this project nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#define __STDC_LIMIT_MACROS
+
+// C
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// POSIX
+#include <sys/uio.h>
+
+// STL
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// po6
+#include <po6/errno.h>
+#include <po6/threads/mutex.h>
+
+// kvbench
+#include "database.h"
+#include "durability.h"
+#include "hash.h"
+#include "log-segments.h"
+#include "offset-reservation.h"
+
+// A log-structured store:  every put and delete appends a record to the log
+// the way kvbench-pwrite does, and an in-memory index maps each key to the
+// offset of its latest record.  Gets and scans pread values back out of the
+// log.  Records are laid out as
+//
+//      [key_sz:4][val_sz:4][key][val]
+//
+// with a val_sz of TOMBSTONE marking a delete.
+class database_log : public database
+{
+    public:
+        database_log();
+        ~database_log() throw ();
+
+    public:
+        virtual const e::argparser& parser();
+        virtual const ygor_series** series();
+        virtual size_t series_sz();
+        virtual bool setup(const char* prefix);
+        virtual bool setup_thread(unsigned idx, void** ptr);
+        virtual bool teardown_thread(void* ptr);
+        virtual bool teardown();
+
+        virtual bool get(void* ptr, const char* key, size_t key_sz);
+        virtual bool put(void* ptr,
+                         const char* key, size_t key_sz,
+                         const char* val, size_t val_sz);
+        virtual bool del(void* ptr, const char* key, size_t key_sz);
+        virtual bool scan(void* ptr, const char* key, size_t key_sz, size_t num);
+
+    private:
+        struct entry;
+        struct stripe;
+        struct cursor;
+        struct thread_state;
+        bool append(thread_state* ts,
+                    const char* key, size_t key_sz,
+                    const char* val, uint32_t val_sz);
+        bool advance(cursor* c, const std::string* seek);
+        stripe* stripe_for(const char* key, size_t key_sz);
+
+    private:
+        e::argparser m_ap;
+        long m_stripes;
+        durability m_durable;
+        durability::tracker m_tracker;
+        log_segments m_segments;
+        offset_reservation m_reserve;
+        const ygor_series* m_series[2];
+        log_segments::table m_log;
+        std::vector<stripe*> m_index;
+
+        database_log(const database_log&);
+        database_log& operator = (const database_log&);
+};
+
+#define HEADER_SZ 8
+#define TOMBSTONE UINT32_MAX
+
+struct database_log::entry
+{
+    entry() : off(0), val_sz(0) {}
+    entry(uint64_t o, uint32_t v) : off(o), val_sz(v) {}
+
+    uint64_t off;
+    uint32_t val_sz;
+};
+
+struct database_log::stripe
+{
+    stripe() : mtx(), index() {}
+
+    po6::threads::mutex mtx;
+    std::map<std::string, entry> index;
+
+    private:
+        stripe(const stripe&);
+        stripe& operator = (const stripe&);
+};
+
+// One stripe's position in a scan: the key and entry it is on, and the
+// iterator past them, which is only used under the stripe's lock and stays
+// valid because the index never erases.
+struct database_log::cursor
+{
+    // heap order, so that the front cursor has the smallest key
+    struct after
+    {
+        bool operator () (const cursor* lhs, const cursor* rhs) const
+        { return lhs->key > rhs->key; }
+    };
+
+    cursor() : stripe(0), it(), key(), ent() {}
+
+    size_t stripe;
+    std::map<std::string, entry>::iterator it;
+    std::string key;
+    entry ent;
+};
+
+struct database_log::thread_state
+{
+    thread_state() : reservation(NULL), buf(), key(), cursors(), heap() {}
+
+    void* reservation;
+    std::vector<char> buf;
+    std::string key;
+    std::vector<cursor> cursors;
+    std::vector<cursor*> heap;
+
+    private:
+        thread_state(const thread_state&);
+        thread_state& operator = (const thread_state&);
+};
+
+database_log :: database_log()
+    : m_ap()
+    , m_stripes(64)
+    , m_durable()
+    , m_tracker()
+    , m_segments()
+    , m_reserve()
+    , m_log()
+    , m_index()
+{
+    m_ap.arg().long_name("index-stripes")
+              .description("split the in-memory index into N independently locked stripes (default: 64)")
+              .metavar("N")
+              .as_long(&m_stripes);
+    m_ap.add("Offset Reservation:", m_reserve.parser());
+    m_ap.add("Durability:", m_durable.parser());
+    m_ap.add("Segments:", m_segments.parser());
+}
+
+database_log :: ~database_log() throw ()
+{
+    for (size_t i = 0; i < m_index.size(); ++i)
+    {
+        delete m_index[i];
+    }
+}
+
+const e::argparser&
+database_log :: parser()
+{
+    return m_ap;
+}
+
+const ygor_series**
+database_log :: series()
+{
+    m_series[0] = m_segments.series();
+    m_series[1] = m_durable.series();
+    return m_series;
+}
+
+size_t
+database_log :: series_sz()
+{
+    return m_durable.series() ? 2 : 1;
+}
+
+bool
+database_log :: setup(const char* prefix)
+{
+    if (m_stripes <= 0)
+    {
+        std::cerr << "--index-stripes must be positive" << std::endl;
+        return false;
+    }
+
+    if (!m_reserve.setup() || !m_durable.setup(m_dl) || !m_segments.setup(m_dl))
+    {
+        return false;
+    }
+
+    for (long i = 0; i < m_stripes; ++i)
+    {
+        m_index.push_back(new stripe());
+    }
+
+    std::string base = prefix;
+    base += "/log";
+    return m_segments.open_table(&m_log, base, m_durable.open_flags());
+}
+
+bool
+database_log :: setup_thread(unsigned, void** ptr)
+{
+    std::auto_ptr<thread_state> ts(new thread_state());
+    ts->cursors.resize(m_index.size());
+    ts->heap.reserve(m_index.size());
+
+    for (size_t i = 0; i < ts->cursors.size(); ++i)
+    {
+        ts->cursors[i].stripe = i;
+    }
+
+    if (!m_reserve.setup_thread(&ts->reservation))
+    {
+        return false;
+    }
+
+    *ptr = ts.release();
+    return true;
+}
+
+bool
+database_log :: teardown_thread(void* ptr)
+{
+    thread_state* ts = static_cast<thread_state*>(ptr);
+    bool ret = true;
+
+    if (ts)
+    {
+        ret = m_reserve.teardown_thread(ts->reservation);
+        delete ts;
+    }
+
+    return ret;
+}
+
+bool
+database_log :: teardown()
+{
+    m_reserve.teardown();
+    m_segments.close_table(&m_log);
+    return true;
+}
+
+bool
+database_log :: get(void* ptr, const char* key, size_t key_sz)
+{
+    thread_state* ts = static_cast<thread_state*>(ptr);
+    stripe* s = stripe_for(key, key_sz);
+    entry e;
+    ts->key.assign(key, key_sz);
+
+    {
+        po6::threads::mutex::hold hold(&s->mtx);
+        std::map<std::string, entry>::iterator it = s->index.find(ts->key);
+
+        if (it == s->index.end() || it->second.val_sz == TOMBSTONE)
+        {
+            return true;
+        }
+
+        e = it->second;
+    }
+
+    ts->buf.resize(e.val_sz + 1);
+
+    if (!m_segments.pread(&m_log, &ts->buf[0], e.val_sz, e.off + HEADER_SZ + key_sz))
+    {
+        std::cerr << "log benchmark failed" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool
+database_log :: put(void* ptr,
+                    const char* key, size_t key_sz,
+                    const char* val, size_t val_sz)
+{
+    if (val_sz >= TOMBSTONE)
+    {
+        std::cerr << "log benchmark failed: value too large" << std::endl;
+        return false;
+    }
+
+    return append(static_cast<thread_state*>(ptr), key, key_sz, val, val_sz);
+}
+
+bool
+database_log :: del(void* ptr, const char* key, size_t key_sz)
+{
+    return append(static_cast<thread_state*>(ptr), key, key_sz, NULL, TOMBSTONE);
+}
+
+bool
+database_log :: scan(void* ptr, const char* key, size_t key_sz, size_t num)
+{
+    thread_state* ts = static_cast<thread_state*>(ptr);
+    ts->key.assign(key, key_sz);
+    ts->heap.clear();
+
+    // each stripe holds a sorted subset of the keys; merge them a key at a
+    // time, so a scan reads num keys rather than num from every stripe
+    for (size_t i = 0; i < ts->cursors.size(); ++i)
+    {
+        if (advance(&ts->cursors[i], &ts->key))
+        {
+            ts->heap.push_back(&ts->cursors[i]);
+        }
+    }
+
+    cursor::after after;
+    std::make_heap(ts->heap.begin(), ts->heap.end(), after);
+
+    for (size_t n = 0; n < num && !ts->heap.empty(); ++n)
+    {
+        std::pop_heap(ts->heap.begin(), ts->heap.end(), after);
+        cursor* c = ts->heap.back();
+        ts->buf.resize(c->ent.val_sz + 1);
+
+        if (!m_segments.pread(&m_log, &ts->buf[0], c->ent.val_sz,
+                              c->ent.off + HEADER_SZ + c->key.size()))
+        {
+            std::cerr << "log benchmark failed" << std::endl;
+            return false;
+        }
+
+        if (advance(c, NULL))
+        {
+            std::push_heap(ts->heap.begin(), ts->heap.end(), after);
+        }
+        else
+        {
+            ts->heap.pop_back();
+        }
+    }
+
+    return true;
+}
+
+bool
+database_log :: append(thread_state* ts,
+                       const char* key, size_t key_sz,
+                       const char* val, uint32_t val_sz)
+{
+    const size_t data_sz = val_sz == TOMBSTONE ? 0 : val_sz;
+    const size_t rec_sz = HEADER_SZ + key_sz + data_sz;
+    const uint32_t ksz = key_sz;
+    ts->buf.resize(rec_sz);
+    memmove(&ts->buf[0], &ksz, sizeof(ksz));
+    memmove(&ts->buf[4], &val_sz, sizeof(val_sz));
+    memmove(&ts->buf[HEADER_SZ], key, key_sz);
+
+    if (data_sz > 0)
+    {
+        memmove(&ts->buf[HEADER_SZ + key_sz], val, data_sz);
+    }
+
+    const uint64_t off = m_reserve.reserve(ts->reservation, rec_sz);
+    iovec iov;
+    iov.iov_base = &ts->buf[0];
+    iov.iov_len = rec_sz;
+
+    if (!m_segments.pwrite(&m_log, &iov, 1, off, &m_durable, &m_tracker))
+    {
+        std::cerr << "log benchmark failed" << std::endl;
+        return false;
+    }
+
+    stripe* s = stripe_for(key, key_sz);
+    ts->key.assign(key, key_sz);
+    po6::threads::mutex::hold hold(&s->mtx);
+    // writers race to the index, and the last to reach it wins; lease
+    // reservation hands out offsets out of order, so a later record need
+    // not lie later in the log
+    s->index[ts->key] = entry(off, val_sz);
+    return true;
+}
+
+// Moves c to the first live key at or after seek, or else after its last
+// key, and copies it out under the stripe's lock.  Returns false once the
+// stripe has no more.
+bool
+database_log :: advance(cursor* c, const std::string* seek)
+{
+    stripe* s = m_index[c->stripe];
+    po6::threads::mutex::hold hold(&s->mtx);
+
+    if (seek)
+    {
+        c->it = s->index.lower_bound(*seek);
+    }
+
+    while (c->it != s->index.end() && c->it->second.val_sz == TOMBSTONE)
+    {
+        ++c->it;
+    }
+
+    if (c->it == s->index.end())
+    {
+        return false;
+    }
+
+    c->key = c->it->first;
+    c->ent = c->it->second;
+    ++c->it;
+    return true;
+}
+
+database_log::stripe*
+database_log :: stripe_for(const char* key, size_t key_sz)
+{
+    return m_index[kvbench_hash(key, key_sz) % m_index.size()];
+}
+
+database*
+database::create()
+{
+    return new database_log();
+}
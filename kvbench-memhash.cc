@@ -0,0 +1,432 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of this project nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <stdint.h>
+#include <string.h>
+
+// STL
+#include <memory>
+#include <vector>
+
+// po6
+#include <po6/threads/mutex.h>
+
+// kvbench
+#include "database.h"
+#include "hash.h"
+
+// An in-memory hash table that bounds how fast the harness itself can go.
+// The table is split into independently locked stripes; each stripe is an
+// open-addressing table with linear probing that doubles when it passes
+// 70% occupancy.  Records live in per-thread arenas as
+//
+//      [key_sz:4][val_sz:4][key][val]
+//
+// and are immutable once written, so gets copy values outside the lock.
+// Overwritten and deleted records are reclaimed only at teardown.
+class database_memhash : public database
+{
+    public:
+        database_memhash();
+        ~database_memhash() throw ();
+
+    public:
+        virtual const e::argparser& parser();
+        virtual bool setup(const char* prefix);
+        virtual bool setup_thread(unsigned idx, void** ptr);
+        virtual bool teardown_thread(void* ptr);
+        virtual bool teardown();
+
+        virtual bool get(void* ptr, const char* key, size_t key_sz);
+        virtual bool put(void* ptr,
+                         const char* key, size_t key_sz,
+                         const char* val, size_t val_sz);
+        virtual bool del(void* ptr, const char* key, size_t key_sz);
+        virtual bool scan(void* ptr, const char* key, size_t key_sz, size_t num);
+
+    private:
+        struct slot;
+        struct stripe;
+        struct arena;
+        stripe* stripe_for(uint64_t h);
+        static slot* find(stripe* s, uint64_t h, const char* key, size_t key_sz, bool insert);
+        static void grow(stripe* s);
+        char* allocate(arena* a, size_t sz);
+
+    private:
+        e::argparser m_ap;
+        long m_capacity;
+        long m_stripes;
+        po6::threads::mutex m_mtx;
+        std::vector<stripe*> m_table;
+        // every arena chunk, freed at teardown
+        std::vector<char*> m_chunks;
+
+        database_memhash(const database_memhash&);
+        database_memhash& operator = (const database_memhash&);
+};
+
+#define ARENA_CHUNK (1ULL << 20)
+#define TOMBSTONE reinterpret_cast<const char*>(1)
+
+static inline uint32_t
+record_key_sz(const char* rec)
+{
+    uint32_t sz;
+    memmove(&sz, rec, sizeof(sz));
+    return sz;
+}
+
+static inline uint32_t
+record_val_sz(const char* rec)
+{
+    uint32_t sz;
+    memmove(&sz, rec + 4, sizeof(sz));
+    return sz;
+}
+
+struct database_memhash::slot
+{
+    slot() : hash(0), rec(NULL) {}
+
+    uint64_t hash;
+    const char* rec;
+};
+
+struct database_memhash::stripe
+{
+    stripe(size_t sz) : mtx(), slots(sz), used(0) {}
+
+    po6::threads::mutex mtx;
+    std::vector<slot> slots;
+    // occupied slots, tombstones included
+    size_t used;
+
+    private:
+        stripe(const stripe&);
+        stripe& operator = (const stripe&);
+};
+
+struct database_memhash::arena
+{
+    arena() : cur(NULL), left(0), buf() {}
+
+    char* cur;
+    size_t left;
+    std::vector<char> buf;
+};
+
+database_memhash :: database_memhash()
+    : m_ap()
+    , m_capacity(1 << 20)
+    , m_stripes(256)
+    , m_mtx()
+    , m_table()
+    , m_chunks()
+{
+    m_ap.arg().long_name("capacity")
+              .description("initial number of slots across all stripes (default: 1048576)")
+              .metavar("N")
+              .as_long(&m_capacity);
+    m_ap.arg().long_name("stripes")
+              .description("number of independently locked stripes (default: 256)")
+              .metavar("N")
+              .as_long(&m_stripes);
+}
+
+database_memhash :: ~database_memhash() throw ()
+{
+}
+
+const e::argparser&
+database_memhash :: parser()
+{
+    return m_ap;
+}
+
+bool
+database_memhash :: setup(const char*)
+{
+    if (m_capacity <= 0 || m_stripes <= 0)
+    {
+        std::cerr << "--capacity and --stripes must be positive" << std::endl;
+        return false;
+    }
+
+    size_t per_stripe = 16;
+
+    while (per_stripe * m_stripes < (size_t)m_capacity)
+    {
+        per_stripe *= 2;
+    }
+
+    for (long i = 0; i < m_stripes; ++i)
+    {
+        m_table.push_back(new stripe(per_stripe));
+    }
+
+    return true;
+}
+
+bool
+database_memhash :: setup_thread(unsigned, void** ptr)
+{
+    *ptr = new arena();
+    return true;
+}
+
+bool
+database_memhash :: teardown_thread(void* ptr)
+{
+    if (ptr)
+    {
+        delete static_cast<arena*>(ptr);
+    }
+
+    return true;
+}
+
+bool
+database_memhash :: teardown()
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    for (size_t i = 0; i < m_table.size(); ++i)
+    {
+        delete m_table[i];
+    }
+
+    for (size_t i = 0; i < m_chunks.size(); ++i)
+    {
+        free(m_chunks[i]);
+    }
+
+    m_table.clear();
+    m_chunks.clear();
+    return true;
+}
+
+bool
+database_memhash :: get(void* ptr, const char* key, size_t key_sz)
+{
+    arena* a = static_cast<arena*>(ptr);
+    const uint64_t h = kvbench_hash(key, key_sz);
+    stripe* s = stripe_for(h);
+    const char* rec = NULL;
+
+    {
+        po6::threads::mutex::hold hold(&s->mtx);
+        slot* sl = find(s, h, key, key_sz, false);
+        rec = sl ? sl->rec : NULL;
+    }
+
+    if (rec)
+    {
+        const uint32_t val_sz = record_val_sz(rec);
+        a->buf.resize(val_sz + 1);
+        memmove(&a->buf[0], rec + 8 + key_sz, val_sz);
+    }
+
+    return true;
+}
+
+bool
+database_memhash :: put(void* ptr,
+                        const char* key, size_t key_sz,
+                        const char* val, size_t val_sz)
+{
+    arena* a = static_cast<arena*>(ptr);
+    char* rec = allocate(a, 8 + key_sz + val_sz);
+
+    if (!rec)
+    {
+        std::cerr << "memhash benchmark failed: out of memory" << std::endl;
+        return false;
+    }
+
+    const uint32_t ksz = key_sz;
+    const uint32_t vsz = val_sz;
+    memmove(rec, &ksz, sizeof(ksz));
+    memmove(rec + 4, &vsz, sizeof(vsz));
+    memmove(rec + 8, key, key_sz);
+    memmove(rec + 8 + key_sz, val, val_sz);
+
+    const uint64_t h = kvbench_hash(key, key_sz);
+    stripe* s = stripe_for(h);
+    po6::threads::mutex::hold hold(&s->mtx);
+    slot* sl = find(s, h, key, key_sz, true);
+    sl->hash = h;
+    sl->rec = rec;
+    return true;
+}
+
+bool
+database_memhash :: del(void*, const char* key, size_t key_sz)
+{
+    const uint64_t h = kvbench_hash(key, key_sz);
+    stripe* s = stripe_for(h);
+    po6::threads::mutex::hold hold(&s->mtx);
+    slot* sl = find(s, h, key, key_sz, false);
+
+    if (sl)
+    {
+        sl->rec = TOMBSTONE;
+    }
+
+    return true;
+}
+
+bool
+database_memhash :: scan(void* ptr, const char* key, size_t key_sz, size_t num)
+{
+    abort();
+    (void) ptr;
+    (void) key;
+    (void) key_sz;
+    (void) num;
+}
+
+database_memhash::stripe*
+database_memhash :: stripe_for(uint64_t h)
+{
+    // the low bits pick the slot within the stripe
+    return m_table[(h >> 32) % m_table.size()];
+}
+
+// Called with s->mtx held.  Returns the live slot holding key, or NULL.
+// With insert, returns the slot to write instead, growing the stripe first
+// if needed.
+database_memhash::slot*
+database_memhash :: find(stripe* s, uint64_t h, const char* key, size_t key_sz, bool insert)
+{
+    if (insert && (s->used + 1) * 10 > s->slots.size() * 7)
+    {
+        grow(s);
+    }
+
+    const size_t mask = s->slots.size() - 1;
+    slot* reuse = NULL;
+
+    for (size_t i = h & mask; ; i = (i + 1) & mask)
+    {
+        slot* sl = &s->slots[i];
+
+        if (!sl->rec)
+        {
+            if (!insert)
+            {
+                return NULL;
+            }
+
+            if (reuse)
+            {
+                return reuse;
+            }
+
+            ++s->used;
+            return sl;
+        }
+
+        if (sl->rec == TOMBSTONE)
+        {
+            if (!reuse)
+            {
+                reuse = sl;
+            }
+
+            continue;
+        }
+
+        if (sl->hash == h &&
+            record_key_sz(sl->rec) == key_sz &&
+            memcmp(sl->rec + 8, key, key_sz) == 0)
+        {
+            return sl;
+        }
+    }
+}
+
+// Called with s->mtx held.  Rehashes live slots into a table twice the
+// size, dropping tombstones.
+void
+database_memhash :: grow(stripe* s)
+{
+    std::vector<slot> old(s->slots.size() * 2);
+    old.swap(s->slots);
+    const size_t mask = s->slots.size() - 1;
+    s->used = 0;
+
+    for (size_t i = 0; i < old.size(); ++i)
+    {
+        if (!old[i].rec || old[i].rec == TOMBSTONE)
+        {
+            continue;
+        }
+
+        size_t j = old[i].hash & mask;
+
+        while (s->slots[j].rec)
+        {
+            j = (j + 1) & mask;
+        }
+
+        s->slots[j] = old[i];
+        ++s->used;
+    }
+}
+
+char*
+database_memhash :: allocate(arena* a, size_t sz)
+{
+    if (sz > a->left)
+    {
+        const size_t chunk_sz = sz > ARENA_CHUNK ? sz : ARENA_CHUNK;
+        char* chunk = static_cast<char*>(malloc(chunk_sz));
+
+        if (!chunk)
+        {
+            return NULL;
+        }
+
+        po6::threads::mutex::hold hold(&m_mtx);
+        m_chunks.push_back(chunk);
+        a->cur = chunk;
+        a->left = chunk_sz;
+    }
+
+    char* ret = a->cur;
+    a->cur += sz;
+    a->left -= sz;
+    return ret;
+}
+
+database*
+database::create()
+{
+    return new database_memhash();
+}
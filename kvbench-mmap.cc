@@ -0,0 +1,328 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of this project nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <stdio.h>
+#include <string.h>
+
+// POSIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// STL
+#include <vector>
+
+// po6
+#include <po6/errno.h>
+#include <po6/threads/mutex.h>
+#include <po6/time.h>
+
+// e
+#include <e/atomic.h>
+
+// kvbench
+#include "database.h"
+
+class database_mmap : public database
+{
+    public:
+        database_mmap();
+        ~database_mmap() throw ();
+
+    public:
+        virtual const e::argparser& parser();
+        virtual bool setup(const char* prefix);
+        virtual bool teardown();
+
+        virtual bool get(void* ptr, const char* key, size_t key_sz);
+        virtual bool put(void* ptr,
+                         const char* key, size_t key_sz,
+                         const char* val, size_t val_sz);
+        virtual bool del(void* ptr, const char* key, size_t key_sz);
+        virtual bool scan(void* ptr, const char* key, size_t key_sz, size_t num);
+
+    private:
+        struct mapping;
+        mapping* grow(uint64_t end);
+        bool maybe_msync(mapping* m, uint64_t end);
+
+    private:
+        e::argparser m_ap;
+        long m_initial_mb;
+        long m_msync_interval;
+        bool m_msync_async;
+        bool m_populate;
+        po6::threads::mutex m_mtx;
+        int m_fd;
+        uint64_t m_off;
+        uint64_t m_last_msync;
+        mapping* m_map;
+        // every mapping ever made; old ones stay valid until teardown
+        std::vector<mapping*> m_maps;
+
+        database_mmap(const database_mmap&);
+        database_mmap& operator = (const database_mmap&);
+};
+
+struct database_mmap::mapping
+{
+    mapping(char* b, uint64_t s) : base(b), size(s) {}
+
+    char* const base;
+    const uint64_t size;
+
+    private:
+        mapping(const mapping&);
+        mapping& operator = (const mapping&);
+};
+
+database_mmap :: database_mmap()
+    : m_ap()
+    , m_initial_mb(64)
+    , m_msync_interval(0)
+    , m_msync_async(false)
+    , m_populate(false)
+    , m_mtx()
+    , m_fd(-1)
+    , m_off(0)
+    , m_last_msync(0)
+    , m_map(NULL)
+    , m_maps()
+{
+    m_ap.arg().long_name("initial-size")
+              .description("preallocate and map this much of the file (default: 64)")
+              .metavar("MB")
+              .as_long(&m_initial_mb);
+    m_ap.arg().long_name("msync-interval")
+              .description("msync the mapping at most once every MS milliseconds (default: never)")
+              .metavar("MS")
+              .as_long(&m_msync_interval);
+    m_ap.arg().long_name("msync-async")
+              .description("use MS_ASYNC instead of MS_SYNC (default: no)")
+              .set_true(&m_msync_async);
+    m_ap.arg().long_name("populate")
+              .description("prefault each mapping with MAP_POPULATE (default: no)")
+              .set_true(&m_populate);
+}
+
+database_mmap :: ~database_mmap() throw ()
+{
+}
+
+const e::argparser&
+database_mmap :: parser()
+{
+    return m_ap;
+}
+
+bool
+database_mmap :: setup(const char* prefix)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (m_initial_mb <= 0 || m_msync_interval < 0)
+    {
+        std::cerr << "--initial-size must be positive and --msync-interval non-negative" << std::endl;
+        return false;
+    }
+
+    std::string path = prefix;
+    path += "/file.dat";
+    m_fd = open(path.c_str(), O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR);
+
+    if (m_fd < 0)
+    {
+        perror("mmap benchmark failed");
+        return false;
+    }
+
+    m_last_msync = po6::monotonic_time();
+    return grow(uint64_t(m_initial_mb) << 20) != NULL;
+}
+
+bool
+database_mmap :: teardown()
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    bool success = true;
+
+    if (m_map && msync(m_map->base, m_map->size, MS_SYNC) < 0)
+    {
+        perror("mmap benchmark failed");
+        success = false;
+    }
+
+    for (size_t i = 0; i < m_maps.size(); ++i)
+    {
+        munmap(m_maps[i]->base, m_maps[i]->size);
+        delete m_maps[i];
+    }
+
+    m_maps.clear();
+    m_map = NULL;
+
+    if (m_fd >= 0)
+    {
+        // trim the preallocated tail so the file holds only what was written
+        if (ftruncate(m_fd, m_off) < 0)
+        {
+            perror("mmap benchmark failed");
+            success = false;
+        }
+
+        close(m_fd);
+        m_fd = -1;
+    }
+
+    return success;
+}
+
+bool
+database_mmap :: get(void* ptr, const char* key, size_t key_sz)
+{
+    abort();
+    (void) ptr;
+    (void) key;
+    (void) key_sz;
+}
+
+bool
+database_mmap :: put(void* ptr,
+                     const char* key, size_t key_sz,
+                     const char* val, size_t val_sz)
+{
+    const uint64_t sz = key_sz + val_sz;
+    const uint64_t off = e::atomic::increment_64_nobarrier(&m_off, sz) - sz;
+    mapping* m = e::atomic::load_ptr_acquire(&m_map);
+
+    if (off + sz > m->size && !(m = grow(off + sz)))
+    {
+        return false;
+    }
+
+    memmove(m->base + off, key, key_sz);
+    memmove(m->base + off + key_sz, val, val_sz);
+    return maybe_msync(m, off + sz);
+    (void) ptr;
+}
+
+bool
+database_mmap :: del(void* ptr, const char* key, size_t key_sz)
+{
+    abort();
+    (void) ptr;
+    (void) key;
+    (void) key_sz;
+}
+
+bool
+database_mmap :: scan(void* ptr, const char* key, size_t key_sz, size_t num)
+{
+    abort();
+    (void) ptr;
+    (void) key;
+    (void) key_sz;
+    (void) num;
+}
+
+// Extend the file and map it again so that [0, end) is covered.  The old
+// mapping is not unmapped because other threads may still be copying into
+// it; both map the same pages of the file.
+database_mmap::mapping*
+database_mmap :: grow(uint64_t end)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (m_map && m_map->size >= end)
+    {
+        return m_map;
+    }
+
+    uint64_t size = m_map ? m_map->size : 0;
+
+    while (size < end)
+    {
+        size = size ? size * 2 : end;
+    }
+
+    int ret = posix_fallocate(m_fd, 0, size);
+
+    if (ret != 0)
+    {
+        std::cerr << "mmap benchmark failed: " << po6::strerror(ret) << std::endl;
+        return NULL;
+    }
+
+    const int flags = MAP_SHARED | (m_populate ? MAP_POPULATE : 0);
+    void* base = mmap(NULL, size, PROT_READ|PROT_WRITE, flags, m_fd, 0);
+
+    if (base == MAP_FAILED)
+    {
+        perror("mmap benchmark failed");
+        return NULL;
+    }
+
+    mapping* m = new mapping(static_cast<char*>(base), size);
+    m_maps.push_back(m);
+    e::atomic::store_ptr_release(&m_map, m);
+    return m;
+}
+
+bool
+database_mmap :: maybe_msync(mapping* m, uint64_t end)
+{
+    if (m_msync_interval <= 0)
+    {
+        return true;
+    }
+
+    const uint64_t now = po6::monotonic_time();
+    const uint64_t last = e::atomic::load_64_nobarrier(&m_last_msync);
+
+    // only the thread that advances m_last_msync performs the msync
+    if (now - last < m_msync_interval * PO6_MILLIS ||
+        e::atomic::compare_and_swap_64_nobarrier(&m_last_msync, last, now) != last)
+    {
+        return true;
+    }
+
+    if (msync(m->base, end, m_msync_async ? MS_ASYNC : MS_SYNC) < 0)
+    {
+        perror("mmap benchmark failed");
+        return false;
+    }
+
+    return true;
+}
+
+database*
+database::create()
+{
+    return new database_mmap();
+}
@@ -0,0 +1,520 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of this project nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// POSIX
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// STL
+#include <string>
+#include <vector>
+
+// e
+#include <e/atomic.h>
+
+// kvbench
+#include "database.h"
+#include "hash.h"
+
+// A hash table kept in a memory-mapped file that persists across runs.
+// The file is a header page, an array of cache-line-sized buckets, and an
+// array of fixed-size record slots:
+//
+//      bucket: [lock:4][fingerprint:1 x 12][slot:4 x 12]
+//      slot:   [key_sz:4][val_sz:4][key][val]
+//
+// A key's home bucket is chosen by hash and the one-byte fingerprints let
+// probes skip entries without touching their slots.  When a bucket is
+// full, inserts move on to the next bucket, up to MAX_PROBE buckets away,
+// and mark the bucket so that lookups follow.  Operations lock the home
+// bucket for their duration and probed buckets in increasing order, so
+// the table never deadlocks.  Puts of existing keys overwrite the value
+// in place; deletes clear the fingerprint and leave the slot number in
+// the bucket for the next insert to reuse.
+class database_mmaphash : public database
+{
+    public:
+        database_mmaphash();
+        ~database_mmaphash() throw ();
+
+    public:
+        virtual const e::argparser& parser();
+        virtual bool setup(const char* prefix);
+        virtual bool setup_thread(unsigned idx, void** ptr);
+        virtual bool teardown_thread(void* ptr);
+        virtual bool teardown();
+
+        virtual bool get(void* ptr, const char* key, size_t key_sz);
+        virtual bool put(void* ptr,
+                         const char* key, size_t key_sz,
+                         const char* val, size_t val_sz);
+        virtual bool del(void* ptr, const char* key, size_t key_sz);
+        virtual bool scan(void* ptr, const char* key, size_t key_sz, size_t num);
+
+    private:
+        struct header;
+        struct bucket;
+        enum { ENTRIES = 12, MAX_PROBE = 16 };
+        enum { LOCKED = 1, SPILLED = 2 };
+        void lock(bucket* b);
+        void unlock(bucket* b);
+        char* slot(uint32_t idx);
+        bool matches(const bucket* b, unsigned i, uint8_t fp,
+                     const char* key, size_t key_sz);
+        bool find(uint64_t home, uint8_t fp, const char* key, size_t key_sz,
+                  unsigned* locked, bucket** b, unsigned* i,
+                  bucket** free_b, unsigned* free_i);
+        void release(uint64_t home, unsigned locked);
+
+    private:
+        e::argparser m_ap;
+        long m_buckets;
+        long m_slot_size;
+        bool m_populate;
+        int m_fd;
+        char* m_base;
+        size_t m_size;
+        header* m_header;
+        bucket* m_table;
+        char* m_slots;
+
+        database_mmaphash(const database_mmaphash&);
+        database_mmaphash& operator = (const database_mmaphash&);
+};
+
+#define MMAPHASH_MAGIC 0x6b76626d6d686173ULL
+#define HEADER_SIZE 4096
+
+struct database_mmaphash::header
+{
+    uint64_t magic;
+    uint64_t buckets;
+    uint64_t slot_size;
+    uint64_t slots;
+    uint64_t next_slot;
+};
+
+struct database_mmaphash::bucket
+{
+    uint32_t lock;
+    uint8_t fp[ENTRIES];
+    // slot numbers start at 1; 0 means the entry has never held a slot
+    uint32_t slot[ENTRIES];
+};
+
+static inline uint8_t
+fingerprint(uint64_t h)
+{
+    // 0 marks an empty entry
+    const uint8_t fp = h >> 56;
+    return fp ? fp : 1;
+}
+
+database_mmaphash :: database_mmaphash()
+    : m_ap()
+    , m_buckets(1 << 16)
+    , m_slot_size(128)
+    , m_populate(false)
+    , m_fd(-1)
+    , m_base(NULL)
+    , m_size(0)
+    , m_header(NULL)
+    , m_table(NULL)
+    , m_slots(NULL)
+{
+    m_ap.arg().long_name("buckets")
+              .description("number of 64-byte buckets, each holding up to 12 keys (default: 65536)")
+              .metavar("N").as_long(&m_buckets);
+    m_ap.arg().long_name("slot-size")
+              .description("bytes reserved for each record, including an 8-byte header (default: 128)")
+              .metavar("BYTES").as_long(&m_slot_size);
+    m_ap.arg().long_name("populate")
+              .description("prefault the mapping with MAP_POPULATE (default: no)")
+              .set_true(&m_populate);
+}
+
+database_mmaphash :: ~database_mmaphash() throw ()
+{
+}
+
+const e::argparser&
+database_mmaphash :: parser()
+{
+    return m_ap;
+}
+
+bool
+database_mmaphash :: setup(const char* prefix)
+{
+    if (sizeof(bucket) != 64)
+    {
+        std::cerr << "mmaphash benchmark failed: buckets are not 64 bytes" << std::endl;
+        return false;
+    }
+
+    if (m_buckets <= 0 || m_slot_size <= 8 || m_slot_size % 8 != 0)
+    {
+        std::cerr << "--buckets must be positive and --slot-size a multiple of 8 larger than 8" << std::endl;
+        return false;
+    }
+
+    // the table has MAX_PROBE spare buckets so that probes never wrap
+    const uint64_t buckets = m_buckets + MAX_PROBE;
+    const uint64_t slots = buckets * ENTRIES;
+    m_size = HEADER_SIZE + buckets * sizeof(bucket) + slots * m_slot_size;
+    std::string path(prefix);
+    path += "/hash.dat";
+    m_fd = open(path.c_str(), O_RDWR|O_CREAT, S_IRUSR|S_IWUSR);
+    struct stat st;
+
+    if (m_fd < 0 || fstat(m_fd, &st) < 0)
+    {
+        perror("mmaphash benchmark failed");
+        return false;
+    }
+
+    // the lock bits in the file belong to this process alone
+    if (flock(m_fd, LOCK_EX|LOCK_NB) < 0)
+    {
+        perror("mmaphash benchmark failed: table in use");
+        return false;
+    }
+
+    const bool created = st.st_size == 0;
+
+    if (created && ftruncate(m_fd, m_size) < 0)
+    {
+        perror("mmaphash benchmark failed");
+        return false;
+    }
+
+    const int flags = MAP_SHARED | (m_populate ? MAP_POPULATE : 0);
+    void* base = mmap(NULL, m_size, PROT_READ|PROT_WRITE, flags, m_fd, 0);
+
+    if (base == MAP_FAILED)
+    {
+        perror("mmaphash benchmark failed");
+        return false;
+    }
+
+    m_base = static_cast<char*>(base);
+    m_header = reinterpret_cast<header*>(m_base);
+    m_table = reinterpret_cast<bucket*>(m_base + HEADER_SIZE);
+    m_slots = m_base + HEADER_SIZE + buckets * sizeof(bucket);
+
+    if (created)
+    {
+        m_header->magic = MMAPHASH_MAGIC;
+        m_header->buckets = buckets;
+        m_header->slot_size = m_slot_size;
+        m_header->slots = slots;
+        m_header->next_slot = 1;
+    }
+    else if ((uint64_t)st.st_size != m_size ||
+             m_header->magic != MMAPHASH_MAGIC ||
+             m_header->buckets != buckets ||
+             m_header->slot_size != (uint64_t)m_slot_size)
+    {
+        std::cerr << "mmaphash benchmark failed: " << path
+                  << " has a different --buckets or --slot-size" << std::endl;
+        return false;
+    }
+    else
+    {
+        // a run killed while holding a bucket lock leaves it set in the
+        // file; the flock above means no one holds them now
+        for (uint64_t i = 0; i < buckets; ++i)
+        {
+            m_table[i].lock &= ~LOCKED;
+        }
+    }
+
+    return true;
+}
+
+bool
+database_mmaphash :: setup_thread(unsigned, void** ptr)
+{
+    *ptr = new std::vector<char>(m_slot_size);
+    return true;
+}
+
+bool
+database_mmaphash :: teardown_thread(void* ptr)
+{
+    if (ptr)
+    {
+        delete static_cast<std::vector<char>*>(ptr);
+    }
+
+    return true;
+}
+
+bool
+database_mmaphash :: teardown()
+{
+    if (m_base)
+    {
+        munmap(m_base, m_size);
+        m_base = NULL;
+    }
+
+    if (m_fd >= 0)
+    {
+        close(m_fd);
+        m_fd = -1;
+    }
+
+    return true;
+}
+
+bool
+database_mmaphash :: get(void* ptr, const char* key, size_t key_sz)
+{
+    std::vector<char>* buf = static_cast<std::vector<char>*>(ptr);
+    const uint64_t h = kvbench_hash(key, key_sz);
+    const uint64_t home = h % m_buckets;
+    unsigned locked = 0;
+    bucket* b = NULL;
+    unsigned i = 0;
+
+    if (find(home, fingerprint(h), key, key_sz, &locked, &b, &i, NULL, NULL))
+    {
+        uint32_t val_sz;
+        const char* rec = slot(b->slot[i]);
+        memmove(&val_sz, rec + 4, sizeof(val_sz));
+        memmove(&(*buf)[0], rec + 8 + key_sz, val_sz);
+    }
+
+    release(home, locked);
+    return true;
+}
+
+bool
+database_mmaphash :: put(void*,
+                         const char* key, size_t key_sz,
+                         const char* val, size_t val_sz)
+{
+    if (8 + key_sz + val_sz > (size_t)m_slot_size)
+    {
+        std::cerr << "mmaphash benchmark failed: record of " << key_sz + val_sz
+                  << " bytes does not fit in --slot-size" << std::endl;
+        return false;
+    }
+
+    const uint64_t h = kvbench_hash(key, key_sz);
+    const uint64_t home = h % m_buckets;
+    const uint8_t fp = fingerprint(h);
+    unsigned locked = 0;
+    bucket* b = NULL;
+    unsigned i = 0;
+    bucket* free_b = NULL;
+    unsigned free_i = 0;
+
+    if (find(home, fp, key, key_sz, &locked, &b, &i, &free_b, &free_i))
+    {
+        const uint32_t sz = val_sz;
+        char* rec = slot(b->slot[i]);
+        memmove(rec + 4, &sz, sizeof(sz));
+        memmove(rec + 8 + key_sz, val, val_sz);
+        release(home, locked);
+        return true;
+    }
+
+    if (!free_b)
+    {
+        release(home, locked);
+        std::cerr << "mmaphash benchmark failed: no free entry within "
+                  << MAX_PROBE << " buckets; use more --buckets" << std::endl;
+        return false;
+    }
+
+    // mark every full bucket between home and the insert, so lookups probe
+    for (bucket* o = m_table + home; o < free_b; ++o)
+    {
+        o->lock |= SPILLED;
+    }
+
+    if (free_b->slot[free_i] == 0)
+    {
+        const uint64_t s = e::atomic::increment_64_nobarrier(&m_header->next_slot, 1) - 1;
+
+        if (s > m_header->slots)
+        {
+            release(home, locked);
+            std::cerr << "mmaphash benchmark failed: out of record slots" << std::endl;
+            return false;
+        }
+
+        free_b->slot[free_i] = s;
+    }
+
+    const uint32_t ksz = key_sz;
+    const uint32_t vsz = val_sz;
+    char* rec = slot(free_b->slot[free_i]);
+    memmove(rec, &ksz, sizeof(ksz));
+    memmove(rec + 4, &vsz, sizeof(vsz));
+    memmove(rec + 8, key, key_sz);
+    memmove(rec + 8 + key_sz, val, val_sz);
+    free_b->fp[free_i] = fp;
+    release(home, locked);
+    return true;
+}
+
+bool
+database_mmaphash :: del(void*, const char* key, size_t key_sz)
+{
+    const uint64_t h = kvbench_hash(key, key_sz);
+    const uint64_t home = h % m_buckets;
+    unsigned locked = 0;
+    bucket* b = NULL;
+    unsigned i = 0;
+
+    if (find(home, fingerprint(h), key, key_sz, &locked, &b, &i, NULL, NULL))
+    {
+        b->fp[i] = 0;
+    }
+
+    release(home, locked);
+    return true;
+}
+
+bool
+database_mmaphash :: scan(void* ptr, const char* key, size_t key_sz, size_t num)
+{
+    abort();
+    (void) ptr;
+    (void) key;
+    (void) key_sz;
+    (void) num;
+}
+
+void
+database_mmaphash :: lock(bucket* b)
+{
+    while (true)
+    {
+        const uint32_t old = e::atomic::load_32_nobarrier(&b->lock);
+
+        if (!(old & LOCKED) &&
+            e::atomic::compare_and_swap_32_acquire(&b->lock, old, old | LOCKED) == old)
+        {
+            return;
+        }
+    }
+}
+
+void
+database_mmaphash :: unlock(bucket* b)
+{
+    e::atomic::store_32_release(&b->lock, b->lock & ~LOCKED);
+}
+
+char*
+database_mmaphash :: slot(uint32_t idx)
+{
+    return m_slots + (uint64_t)(idx - 1) * m_slot_size;
+}
+
+bool
+database_mmaphash :: matches(const bucket* b, unsigned i, uint8_t fp,
+                             const char* key, size_t key_sz)
+{
+    if (b->fp[i] != fp)
+    {
+        return false;
+    }
+
+    uint32_t sz;
+    const char* rec = slot(b->slot[i]);
+    memmove(&sz, rec, sizeof(sz));
+    return sz == key_sz && memcmp(rec + 8, key, key_sz) == 0;
+}
+
+// Locks the home bucket and each bucket probed after it, counting them in
+// *locked for release().  On success, *b and *i locate the key.  Otherwise
+// *free_b and *free_i (when requested) locate the first free entry, or
+// *free_b is left NULL.
+bool
+database_mmaphash :: find(uint64_t home, uint8_t fp, const char* key, size_t key_sz,
+                          unsigned* locked, bucket** b, unsigned* i,
+                          bucket** free_b, unsigned* free_i)
+{
+    for (unsigned p = 0; p < MAX_PROBE; ++p)
+    {
+        bucket* cur = m_table + home + p;
+        lock(cur);
+        ++*locked;
+
+        for (unsigned j = 0; j < ENTRIES; ++j)
+        {
+            if (matches(cur, j, fp, key, key_sz))
+            {
+                *b = cur;
+                *i = j;
+                return true;
+            }
+
+            if (free_b && !*free_b && cur->fp[j] == 0)
+            {
+                *free_b = cur;
+                *free_i = j;
+            }
+        }
+
+        // nothing was ever pushed past this bucket
+        if (!(cur->lock & SPILLED) && (!free_b || *free_b))
+        {
+            return false;
+        }
+    }
+
+    return false;
+}
+
+void
+database_mmaphash :: release(uint64_t home, unsigned locked)
+{
+    for (unsigned p = 0; p < locked; ++p)
+    {
+        unlock(m_table + home + p);
+    }
+}
+
+database*
+database::create()
+{
+    return new database_mmaphash();
+}
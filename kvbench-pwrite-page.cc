@@ -31,6 +31,7 @@
 // POSIX
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 // STL
@@ -42,6 +43,9 @@
 
 // kvbench
 #include "database.h"
+#include "durability.h"
+#include "log-segments.h"
+#include "offset-reservation.h"
 
 class database_pwrite_page : public database
 {
@@ -51,6 +55,8 @@ class database_pwrite_page : public database
 
     public:
         virtual const e::argparser& parser();
+        virtual const ygor_series** series();
+        virtual size_t series_sz();
         virtual bool setup(const char* prefix);
         virtual bool setup_thread(unsigned idx, void** ptr);
         virtual bool teardown_thread(void* ptr);
@@ -65,10 +71,15 @@ class database_pwrite_page : public database
 
     private:
         e::argparser m_ap;
-        bool m_fsync;
+        durability m_durable;
+        durability::tracker m_tracker;
+        log_segments m_segments;
+        const ygor_series* m_series[2];
+        bool m_direct;
+        long m_block_sz;
+        offset_reservation m_reserve;
         po6::threads::mutex m_mtx;
-        off_t m_off;
-        int m_fd;
+        log_segments::table m_log;
 
         database_pwrite_page(const database_pwrite_page&);
         database_pwrite_page& operator = (const database_pwrite_page&);
@@ -76,14 +87,25 @@ class database_pwrite_page : public database
 
 database_pwrite_page :: database_pwrite_page()
     : m_ap()
-    , m_fsync(false)
+    , m_durable()
+    , m_tracker()
+    , m_segments()
+    , m_direct(false)
+    , m_block_sz(sysconf(_SC_PAGESIZE))
+    , m_reserve()
     , m_mtx()
-    , m_off(0)
-    , m_fd(-1)
+    , m_log()
 {
-    m_ap.arg().long_name("fsync")
-              .description("perform an fsync after each write (default: no)")
-              .set_true(&m_fsync);
+    m_ap.arg().long_name("direct")
+              .description("open the file with O_DIRECT, bypassing the page cache (default: no)")
+              .set_true(&m_direct);
+    m_ap.arg().long_name("block-size")
+              .description("align buffers and pad records to this size (default: page size)")
+              .metavar("BYTES")
+              .as_long(&m_block_sz);
+    m_ap.add("Offset Reservation:", m_reserve.parser());
+    m_ap.add("Durability:", m_durable.parser());
+    m_ap.add("Segments:", m_segments.parser());
 }
 
 database_pwrite_page :: ~database_pwrite_page() throw ()
@@ -96,51 +118,105 @@ database_pwrite_page :: parser()
     return m_ap;
 }
 
+const ygor_series**
+database_pwrite_page :: series()
+{
+    m_series[0] = m_segments.series();
+    m_series[1] = m_durable.series();
+    return m_series;
+}
+
+size_t
+database_pwrite_page :: series_sz()
+{
+    return m_durable.series() ? 2 : 1;
+}
+
 bool
 database_pwrite_page :: setup(const char* prefix)
 {
     po6::threads::mutex::hold hold(&m_mtx);
-    std::string path = prefix;
-    path += "/file.dat";
-    m_fd = open(path.c_str(), O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR);
 
-    if (m_fd < 0)
+    if (m_block_sz < 512 || (m_block_sz & (m_block_sz - 1)) != 0)
     {
-        perror("pwrite benchmark failed");
+        std::cerr << "--block-size must be a power of two no smaller than 512" << std::endl;
         return false;
     }
 
-    return true;
+    if (!m_reserve.setup() || !m_durable.setup(m_dl) || !m_segments.setup(m_dl))
+    {
+        return false;
+    }
+
+    std::string base = prefix;
+    base += "/file";
+    int flags = m_durable.open_flags();
+
+    if (m_direct)
+    {
+        flags |= O_DIRECT;
+    }
+
+    return m_segments.open_table(&m_log, base, flags);
 }
 
+// Buffers are always block-aligned so that the same code path works with
+// and without O_DIRECT.
 struct pwrite_page
 {
-    pwrite_page(size_t ps) : page_sz(ps), buf(NULL), buf_sz(0) {}
+    pwrite_page(size_t bs) : block_sz(bs), buf(NULL), buf_sz(0), reservation(NULL) {}
     ~pwrite_page() throw () { if (buf) free(buf); }
+    bool reserve(size_t sz);
 
-    const size_t page_sz;
+    const size_t block_sz;
     char* buf;
     size_t buf_sz;
+    void* reservation;
 
     private:
         pwrite_page(const pwrite_page&);
         pwrite_page& operator = (const pwrite_page&);
 };
 
+bool
+pwrite_page :: reserve(size_t sz)
+{
+    if (sz <= buf_sz)
+    {
+        return true;
+    }
+
+    void* tmp = NULL;
+    int ret = posix_memalign(&tmp, block_sz, sz);
+
+    if (ret != 0)
+    {
+        errno = ret;
+        return false;
+    }
+
+    if (buf)
+    {
+        free(buf);
+    }
+
+    buf = static_cast<char*>(tmp);
+    buf_sz = sz;
+    return true;
+}
+
 bool
 database_pwrite_page :: setup_thread(unsigned, void** ptr)
 {
     *ptr = NULL;
-    const size_t page_sz = sysconf(_SC_PAGESIZE);
-    std::auto_ptr<pwrite_page> pp(new pwrite_page(page_sz));
-    pp->buf = (char*)malloc(page_sz);
+    std::auto_ptr<pwrite_page> pp(new pwrite_page(m_block_sz));
 
-    if (!pp->buf)
+    if (!pp->reserve(m_block_sz) ||
+        !m_reserve.setup_thread(&pp->reservation))
     {
         return false;
     }
 
-    pp->buf_sz = page_sz;
     *ptr = static_cast<void*>(pp.release());
     return true;
 }
@@ -150,25 +226,23 @@ database_pwrite_page :: teardown_thread(void* ptr)
 {
     pwrite_page* pp = static_cast<pwrite_page*>(ptr);
 
+    bool ret = true;
+
     if (pp)
     {
+        ret = m_reserve.teardown_thread(pp->reservation);
         delete pp;
     }
 
-    return true;
+    return ret;
 }
 
 bool
 database_pwrite_page :: teardown()
 {
     po6::threads::mutex::hold hold(&m_mtx);
-
-    if (m_fd >= 0)
-    {
-        close(m_fd);
-        m_fd = -1;
-    }
-
+    m_reserve.teardown();
+    m_segments.close_table(&m_log);
     return true;
 }
 
@@ -187,43 +261,29 @@ database_pwrite_page :: put(void* ptr,
                             const char* val, size_t val_sz)
 {
     pwrite_page* pp = static_cast<pwrite_page*>(ptr);
-    const size_t write_sz = (key_sz + val_sz - 1 + pp->page_sz) & ~(pp->page_sz - 1);
+    const size_t write_sz = (key_sz + val_sz - 1 + pp->block_sz) & ~(pp->block_sz - 1);
 
-    if (write_sz > pp->buf_sz)
+    if (!pp->reserve(write_sz))
     {
-        char* buf = (char*)realloc(pp->buf, write_sz);
-
-        if (!buf)
-        {
-            perror("pwrite benchmark failed");
-            return false;
-        }
-
-        pp->buf = buf;
-        pp->buf_sz = write_sz;
+        perror("pwrite benchmark failed");
+        return false;
     }
 
     memmove(pp->buf, key, key_sz);
     memmove(pp->buf + key_sz, val, val_sz);
-    m_mtx.lock();
-    off_t off = m_off;
-    m_off += write_sz;
-    m_mtx.unlock();
+    const off_t off = m_reserve.reserve(pp->reservation, write_sz);
 
-    if (pwrite(m_fd, pp->buf, write_sz, off) != (ssize_t)write_sz)
-    {
-        perror("pwrite benchmark failed");
-        return false;
-    }
+    iovec iov;
+    iov.iov_base = pp->buf;
+    iov.iov_len = write_sz;
 
-    if (m_fsync && fsync(m_fd) < 0)
+    if (!m_segments.pwrite(&m_log, &iov, 1, off, &m_durable, &m_tracker))
     {
-        perror("pwrite benchmark failed");
+        std::cerr << "pwrite benchmark failed" << std::endl;
         return false;
     }
 
     return true;
-    (void) ptr;
 }
 
 bool
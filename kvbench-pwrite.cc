@@ -31,6 +31,7 @@
 // POSIX
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 // po6
@@ -39,6 +40,9 @@
 
 // kvbench
 #include "database.h"
+#include "durability.h"
+#include "log-segments.h"
+#include "offset-reservation.h"
 
 class database_pwrite : public database
 {
@@ -48,7 +52,11 @@ class database_pwrite : public database
 
     public:
         virtual const e::argparser& parser();
+        virtual const ygor_series** series();
+        virtual size_t series_sz();
         virtual bool setup(const char* prefix);
+        virtual bool setup_thread(unsigned idx, void** ptr);
+        virtual bool teardown_thread(void* ptr);
         virtual bool teardown();
 
         virtual bool get(void* ptr, const char* key, size_t key_sz);
@@ -60,10 +68,13 @@ class database_pwrite : public database
 
     private:
         e::argparser m_ap;
-        bool m_fsync;
+        durability m_durable;
+        durability::tracker m_tracker;
+        log_segments m_segments;
+        const ygor_series* m_series[2];
+        offset_reservation m_reserve;
         po6::threads::mutex m_mtx;
-        off_t m_off;
-        int m_fd;
+        log_segments::table m_log;
 
         database_pwrite(const database_pwrite&);
         database_pwrite& operator = (const database_pwrite&);
@@ -71,14 +82,16 @@ class database_pwrite : public database
 
 database_pwrite :: database_pwrite()
     : m_ap()
-    , m_fsync(false)
+    , m_durable()
+    , m_tracker()
+    , m_segments()
+    , m_reserve()
     , m_mtx()
-    , m_off(0)
-    , m_fd(-1)
+    , m_log()
 {
-    m_ap.arg().long_name("fsync")
-              .description("perform an fsync after each write (default: no)")
-              .set_true(&m_fsync);
+    m_ap.add("Durability:", m_durable.parser());
+    m_ap.add("Offset Reservation:", m_reserve.parser());
+    m_ap.add("Segments:", m_segments.parser());
 }
 
 database_pwrite :: ~database_pwrite() throw ()
@@ -91,34 +104,53 @@ database_pwrite :: parser()
     return m_ap;
 }
 
+const ygor_series**
+database_pwrite :: series()
+{
+    m_series[0] = m_segments.series();
+    m_series[1] = m_durable.series();
+    return m_series;
+}
+
+size_t
+database_pwrite :: series_sz()
+{
+    return m_durable.series() ? 2 : 1;
+}
+
 bool
 database_pwrite :: setup(const char* prefix)
 {
     po6::threads::mutex::hold hold(&m_mtx);
-    std::string path = prefix;
-    path += "/file.dat";
-    m_fd = open(path.c_str(), O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR);
 
-    if (m_fd < 0)
+    if (!m_reserve.setup() || !m_durable.setup(m_dl) || !m_segments.setup(m_dl))
     {
-        perror("pwrite benchmark failed");
         return false;
     }
 
-    return true;
+    std::string base = prefix;
+    base += "/file";
+    return m_segments.open_table(&m_log, base, m_durable.open_flags());
 }
 
 bool
-database_pwrite :: teardown()
+database_pwrite :: setup_thread(unsigned, void** ptr)
 {
-    po6::threads::mutex::hold hold(&m_mtx);
+    return m_reserve.setup_thread(ptr);
+}
 
-    if (m_fd >= 0)
-    {
-        close(m_fd);
-        m_fd = -1;
-    }
+bool
+database_pwrite :: teardown_thread(void* ptr)
+{
+    return m_reserve.teardown_thread(ptr);
+}
 
+bool
+database_pwrite :: teardown()
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    m_reserve.teardown();
+    m_segments.close_table(&m_log);
     return true;
 }
 
@@ -136,28 +168,20 @@ database_pwrite :: put(void* ptr,
                        const char* key, size_t key_sz,
                        const char* val, size_t val_sz)
 {
-    m_mtx.lock();
-    off_t key_off = m_off;
-    m_off += key_sz;
-    off_t val_off = m_off;
-    m_off += val_sz;
-    m_mtx.unlock();
-
-    if (pwrite(m_fd, key, key_sz, key_off) != (ssize_t)key_sz ||
-        pwrite(m_fd, val, val_sz, val_off) != (ssize_t)val_sz)
-    {
-        perror("pwrite benchmark failed");
-        return false;
-    }
-
-    if (m_fsync && fsync(m_fd) < 0)
+    const off_t off = m_reserve.reserve(ptr, key_sz + val_sz);
+    iovec iov[2];
+    iov[0].iov_base = const_cast<char*>(key);
+    iov[0].iov_len = key_sz;
+    iov[1].iov_base = const_cast<char*>(val);
+    iov[1].iov_len = val_sz;
+
+    if (!m_segments.pwrite(&m_log, iov, 2, off, &m_durable, &m_tracker))
     {
-        perror("pwrite benchmark failed");
+        std::cerr << "pwrite benchmark failed" << std::endl;
         return false;
     }
 
     return true;
-    (void) ptr;
 }
 
 bool
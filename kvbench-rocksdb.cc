@@ -0,0 +1,332 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of this project nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#define __STDC_LIMIT_MACROS
+
+// C
+#include <string.h>
+#include <unistd.h>
+
+// STL
+#include <memory>
+#include <vector>
+
+// RocksDB
+#include <rocksdb/cache.h>
+#include <rocksdb/db.h>
+#include <rocksdb/filter_policy.h>
+#include <rocksdb/table.h>
+#include <rocksdb/write_batch.h>
+
+// kvbench
+#include "database.h"
+
+class database_rocksdb : public database
+{
+    public:
+        database_rocksdb();
+        ~database_rocksdb() throw ();
+
+    public:
+        virtual const e::argparser& parser();
+        virtual bool setup(const char* prefix);
+        virtual bool teardown();
+
+        virtual bool get(void* ptr, const char* key, size_t key_sz);
+        virtual bool put(void* ptr,
+                         const char* key, size_t key_sz,
+                         const char* val, size_t val_sz);
+        virtual bool del(void* ptr, const char* key, size_t key_sz);
+        virtual bool scan(void* ptr, const char* key, size_t key_sz, size_t num);
+
+        virtual bool multi_get(void* ptr, size_t num,
+                               const char* const* keys, const size_t* key_szs);
+        virtual bool multi_put(void* ptr, size_t num,
+                               const char* const* keys, const size_t* key_szs,
+                               const char* const* vals, const size_t* val_szs);
+
+    private:
+        e::argparser m_ap;
+        long m_block_cache;
+        long m_write_buffer_size;
+        long m_write_buffers;
+        const char* m_compaction_style;
+        long m_bloom_bits;
+        bool m_direct_io;
+        bool m_pipelined_write;
+        rocksdb::DB* m_db;
+
+        database_rocksdb(const database_rocksdb&);
+        database_rocksdb& operator = (const database_rocksdb&);
+};
+
+database_rocksdb :: database_rocksdb()
+    : m_ap()
+    , m_block_cache(8)
+    , m_write_buffer_size(64)
+    , m_write_buffers(2)
+    , m_compaction_style("level")
+    , m_bloom_bits(10)
+    , m_direct_io(false)
+    , m_pipelined_write(false)
+    , m_db(NULL)
+{
+    m_ap.arg().long_name("block-cache")
+              .description("size of the block cache in MB; 0 disables it (default: 8)")
+              .metavar("MB").as_long(&m_block_cache);
+    m_ap.arg().long_name("write-buffer-size")
+              .description("size of each memtable in MB (default: 64)")
+              .metavar("MB").as_long(&m_write_buffer_size);
+    m_ap.arg().long_name("write-buffers")
+              .description("maximum number of memtables (default: 2)")
+              .metavar("N").as_long(&m_write_buffers);
+    m_ap.arg().long_name("compaction-style")
+              .description("compaction style: level, universal, or fifo (default: level)")
+              .metavar("STYLE").as_string(&m_compaction_style);
+    m_ap.arg().long_name("bloom-bits")
+              .description("bloom filter bits per key; 0 disables filters (default: 10)")
+              .metavar("N").as_long(&m_bloom_bits);
+    m_ap.arg().long_name("direct-io")
+              .description("use O_DIRECT for reads, flushes, and compactions (default: no)")
+              .set_true(&m_direct_io);
+    m_ap.arg().long_name("pipelined-write")
+              .description("pipeline WAL and memtable writes (default: no)")
+              .set_true(&m_pipelined_write);
+}
+
+database_rocksdb :: ~database_rocksdb() throw ()
+{
+}
+
+const e::argparser&
+database_rocksdb :: parser()
+{
+    return m_ap;
+}
+
+bool
+database_rocksdb :: setup(const char* prefix)
+{
+    if (m_block_cache < 0 || m_write_buffer_size <= 0 ||
+        m_write_buffers <= 0 || m_bloom_bits < 0)
+    {
+        std::cerr << "rocksdb sizes must be positive" << std::endl;
+        return false;
+    }
+
+    rocksdb::Options opts;
+    opts.create_if_missing = true;
+    opts.max_open_files = std::max(sysconf(_SC_OPEN_MAX) >> 1, 1024L);
+    opts.write_buffer_size = m_write_buffer_size * 1024ULL * 1024ULL;
+    opts.max_write_buffer_number = m_write_buffers;
+    opts.use_direct_reads = m_direct_io;
+    opts.use_direct_io_for_flush_and_compaction = m_direct_io;
+    opts.enable_pipelined_write = m_pipelined_write;
+
+    if (strcmp(m_compaction_style, "level") == 0)
+    {
+        opts.compaction_style = rocksdb::kCompactionStyleLevel;
+    }
+    else if (strcmp(m_compaction_style, "universal") == 0)
+    {
+        opts.compaction_style = rocksdb::kCompactionStyleUniversal;
+    }
+    else if (strcmp(m_compaction_style, "fifo") == 0)
+    {
+        opts.compaction_style = rocksdb::kCompactionStyleFIFO;
+    }
+    else
+    {
+        std::cerr << "unknown compaction style: " << m_compaction_style << std::endl;
+        return false;
+    }
+
+    rocksdb::BlockBasedTableOptions table;
+
+    if (m_block_cache > 0)
+    {
+        table.block_cache = rocksdb::NewLRUCache(m_block_cache * 1024ULL * 1024ULL);
+    }
+    else
+    {
+        table.no_block_cache = true;
+    }
+
+    if (m_bloom_bits > 0)
+    {
+        table.filter_policy.reset(rocksdb::NewBloomFilterPolicy(m_bloom_bits));
+    }
+
+    opts.table_factory.reset(rocksdb::NewBlockBasedTableFactory(table));
+    rocksdb::Status st = rocksdb::DB::Open(opts, prefix, &m_db);
+
+    if (!st.ok())
+    {
+        std::cerr << "could not open RocksDB: " << st.ToString() << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool
+database_rocksdb :: teardown()
+{
+    if (m_db)
+    {
+        delete m_db;
+    }
+
+    return true;
+}
+
+bool
+database_rocksdb :: get(void*, const char* key, size_t key_sz)
+{
+    std::string value;
+    rocksdb::Status st = m_db->Get(rocksdb::ReadOptions(), rocksdb::Slice(key, key_sz), &value);
+
+    if (!st.ok() && !st.IsNotFound())
+    {
+        std::cerr << "rocksdb error: " << st.ToString() << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool
+database_rocksdb :: put(void*,
+                        const char* key, size_t key_sz,
+                        const char* val, size_t val_sz)
+{
+    rocksdb::WriteOptions opts;
+    opts.sync = false;
+    rocksdb::Status st = m_db->Put(opts, rocksdb::Slice(key, key_sz), rocksdb::Slice(val, val_sz));
+
+    if (!st.ok())
+    {
+        std::cerr << "rocksdb error: " << st.ToString() << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool
+database_rocksdb :: del(void*, const char* key, size_t key_sz)
+{
+    rocksdb::WriteOptions opts;
+    opts.sync = false;
+    rocksdb::Status st = m_db->Delete(opts, rocksdb::Slice(key, key_sz));
+
+    if (!st.ok() && !st.IsNotFound())
+    {
+        std::cerr << "rocksdb error: " << st.ToString() << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool
+database_rocksdb :: scan(void*, const char* key, size_t key_sz, size_t num)
+{
+    std::auto_ptr<rocksdb::Iterator> it(m_db->NewIterator(rocksdb::ReadOptions()));
+    it->Seek(rocksdb::Slice(key, key_sz));
+
+    for (size_t i = 0; i < num && it->Valid(); ++i)
+    {
+        it->Next();
+    }
+
+    if (!it->status().ok())
+    {
+        std::cerr << "rocksdb error: " << it->status().ToString() << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool
+database_rocksdb :: multi_get(void*, size_t num,
+                              const char* const* keys, const size_t* key_szs)
+{
+    std::vector<rocksdb::Slice> ks;
+    std::vector<std::string> values;
+    ks.reserve(num);
+
+    for (size_t i = 0; i < num; ++i)
+    {
+        ks.push_back(rocksdb::Slice(keys[i], key_szs[i]));
+    }
+
+    std::vector<rocksdb::Status> sts = m_db->MultiGet(rocksdb::ReadOptions(), ks, &values);
+
+    for (size_t i = 0; i < sts.size(); ++i)
+    {
+        if (!sts[i].ok() && !sts[i].IsNotFound())
+        {
+            std::cerr << "rocksdb error: " << sts[i].ToString() << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool
+database_rocksdb :: multi_put(void*, size_t num,
+                              const char* const* keys, const size_t* key_szs,
+                              const char* const* vals, const size_t* val_szs)
+{
+    rocksdb::WriteBatch batch;
+
+    for (size_t i = 0; i < num; ++i)
+    {
+        batch.Put(rocksdb::Slice(keys[i], key_szs[i]), rocksdb::Slice(vals[i], val_szs[i]));
+    }
+
+    rocksdb::WriteOptions opts;
+    opts.sync = false;
+    rocksdb::Status st = m_db->Write(opts, &batch);
+
+    if (!st.ok())
+    {
+        std::cerr << "rocksdb error: " << st.ToString() << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+database*
+database::create()
+{
+    return new database_rocksdb();
+}
@@ -0,0 +1,507 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of this project nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// STL
+#include <algorithm>
+#include <vector>
+
+// po6
+#include <po6/threads/mutex.h>
+
+// e
+#include <e/atomic.h>
+
+// kvbench
+#include "database.h"
+
+// A lock-free skiplist:  writers link new nodes bottom-up with a CAS per
+// level, retrying a level from its predecessor when they lose a race.
+// Nodes are never unlinked; a delete clears the node's value pointer and a
+// later put of the same key installs a new one.  Nodes and values are
+// allocated from per-thread arenas that are freed at teardown.
+//
+// --inline-keys stores each key in the same allocation as its node and
+// compares an 8-byte big-endian key prefix before touching the key bytes.
+// --prefetch prefetches the next node's successor while searching.
+class database_skiplist : public database
+{
+    public:
+        database_skiplist();
+        ~database_skiplist() throw ();
+
+    public:
+        virtual const e::argparser& parser();
+        virtual bool setup(const char* prefix);
+        virtual bool setup_thread(unsigned idx, void** ptr);
+        virtual bool teardown_thread(void* ptr);
+        virtual bool teardown();
+
+        virtual bool get(void* ptr, const char* key, size_t key_sz);
+        virtual bool put(void* ptr,
+                         const char* key, size_t key_sz,
+                         const char* val, size_t val_sz);
+        virtual bool del(void* ptr, const char* key, size_t key_sz);
+        virtual bool scan(void* ptr, const char* key, size_t key_sz, size_t num);
+
+    private:
+        struct node;
+        struct thread_state;
+        int compare(const node* n, const char* key, size_t key_sz, uint64_t prefix);
+        node* seek(const char* key, size_t key_sz, uint64_t prefix, node** prevs);
+        node* create_node(thread_state* ts, const char* key, size_t key_sz,
+                          uint64_t prefix, unsigned height);
+        const char* create_value(thread_state* ts, const char* val, size_t val_sz);
+        char* allocate(thread_state* ts, size_t sz);
+        void touch(thread_state* ts, const char* val);
+
+    private:
+        e::argparser m_ap;
+        bool m_inline_keys;
+        bool m_prefetch;
+        po6::threads::mutex m_mtx;
+        node* m_head;
+        // every arena chunk, freed at teardown
+        std::vector<char*> m_chunks;
+
+        database_skiplist(const database_skiplist&);
+        database_skiplist& operator = (const database_skiplist&);
+};
+
+#define MAX_HEIGHT 20
+#define ARENA_CHUNK (1ULL << 20)
+
+struct database_skiplist::node
+{
+    const char* key;
+    uint32_t key_sz;
+    uint32_t height;
+    uint64_t prefix;
+    // [val_sz:4][val], or NULL when deleted
+    const char* val;
+    // height entries; with --inline-keys, the key follows them
+    node* next[1];
+};
+
+struct database_skiplist::thread_state
+{
+    thread_state(uint64_t seed) : rng(seed | 1), cur(NULL), left(0), buf() {}
+    unsigned random_height();
+
+    uint64_t rng;
+    char* cur;
+    size_t left;
+    std::vector<char> buf;
+};
+
+unsigned
+database_skiplist :: thread_state :: random_height()
+{
+    unsigned height = 1;
+
+    while (height < MAX_HEIGHT)
+    {
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+
+        // branching factor of four
+        if ((rng & 3) != 0)
+        {
+            break;
+        }
+
+        ++height;
+    }
+
+    return height;
+}
+
+static inline uint64_t
+key_prefix(const char* key, size_t key_sz)
+{
+    uint64_t prefix = 0;
+
+    for (size_t i = 0; i < 8; ++i)
+    {
+        prefix <<= 8;
+        prefix |= i < key_sz ? (unsigned char)key[i] : 0;
+    }
+
+    return prefix;
+}
+
+database_skiplist :: database_skiplist()
+    : m_ap()
+    , m_inline_keys(false)
+    , m_prefetch(false)
+    , m_mtx()
+    , m_head(NULL)
+    , m_chunks()
+{
+    m_ap.arg().long_name("inline-keys")
+              .description("store keys inside their nodes and compare 8-byte prefixes first (default: no)")
+              .set_true(&m_inline_keys);
+    m_ap.arg().long_name("prefetch")
+              .description("prefetch successor nodes while searching (default: no)")
+              .set_true(&m_prefetch);
+}
+
+database_skiplist :: ~database_skiplist() throw ()
+{
+}
+
+const e::argparser&
+database_skiplist :: parser()
+{
+    return m_ap;
+}
+
+bool
+database_skiplist :: setup(const char*)
+{
+    const size_t sz = sizeof(node) + (MAX_HEIGHT - 1) * sizeof(node*);
+    m_head = static_cast<node*>(calloc(1, sz));
+
+    if (!m_head)
+    {
+        std::cerr << "skiplist benchmark failed: out of memory" << std::endl;
+        return false;
+    }
+
+    m_head->key = "";
+    m_head->height = MAX_HEIGHT;
+    return true;
+}
+
+bool
+database_skiplist :: setup_thread(unsigned idx, void** ptr)
+{
+    *ptr = new thread_state(0x9e3779b97f4a7c15ULL * (idx + 1));
+    return true;
+}
+
+bool
+database_skiplist :: teardown_thread(void* ptr)
+{
+    if (ptr)
+    {
+        delete static_cast<thread_state*>(ptr);
+    }
+
+    return true;
+}
+
+bool
+database_skiplist :: teardown()
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    for (size_t i = 0; i < m_chunks.size(); ++i)
+    {
+        free(m_chunks[i]);
+    }
+
+    m_chunks.clear();
+    free(m_head);
+    m_head = NULL;
+    return true;
+}
+
+bool
+database_skiplist :: get(void* ptr, const char* key, size_t key_sz)
+{
+    thread_state* ts = static_cast<thread_state*>(ptr);
+    const uint64_t prefix = key_prefix(key, key_sz);
+    node* n = seek(key, key_sz, prefix, NULL);
+
+    if (n && compare(n, key, key_sz, prefix) == 0)
+    {
+        touch(ts, e::atomic::load_ptr_acquire(&n->val));
+    }
+
+    return true;
+}
+
+bool
+database_skiplist :: put(void* ptr,
+                         const char* key, size_t key_sz,
+                         const char* val, size_t val_sz)
+{
+    thread_state* ts = static_cast<thread_state*>(ptr);
+    const uint64_t prefix = key_prefix(key, key_sz);
+    const char* v = create_value(ts, val, val_sz);
+    node* prevs[MAX_HEIGHT];
+    node* n = seek(key, key_sz, prefix, prevs);
+
+    if (!v)
+    {
+        std::cerr << "skiplist benchmark failed: out of memory" << std::endl;
+        return false;
+    }
+
+    if (n && compare(n, key, key_sz, prefix) == 0)
+    {
+        e::atomic::store_ptr_release(&n->val, v);
+        return true;
+    }
+
+    const unsigned height = ts->random_height();
+    node* x = create_node(ts, key, key_sz, prefix, height);
+
+    if (!x)
+    {
+        std::cerr << "skiplist benchmark failed: out of memory" << std::endl;
+        return false;
+    }
+
+    x->val = v;
+
+    for (unsigned level = 0; level < height; ++level)
+    {
+        while (true)
+        {
+            node* prev = prevs[level];
+            node* next = e::atomic::load_ptr_acquire(&prev->next[level]);
+
+            // another writer may have linked nodes here since the seek
+            while (next && compare(next, key, key_sz, prefix) < 0)
+            {
+                prev = next;
+                next = e::atomic::load_ptr_acquire(&prev->next[level]);
+            }
+
+            prevs[level] = prev;
+
+            // a concurrent put of the same key won the race to level 0;
+            // our node is abandoned in the arena
+            if (level == 0 && next && compare(next, key, key_sz, prefix) == 0)
+            {
+                e::atomic::store_ptr_release(&next->val, v);
+                return true;
+            }
+
+            e::atomic::store_ptr_nobarrier(&x->next[level], next);
+
+            if (e::atomic::compare_and_swap_ptr_release(&prev->next[level], next, x) == next)
+            {
+                break;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool
+database_skiplist :: del(void*, const char* key, size_t key_sz)
+{
+    const uint64_t prefix = key_prefix(key, key_sz);
+    node* n = seek(key, key_sz, prefix, NULL);
+
+    if (n && compare(n, key, key_sz, prefix) == 0)
+    {
+        e::atomic::store_ptr_release(&n->val, (const char*)NULL);
+    }
+
+    return true;
+}
+
+bool
+database_skiplist :: scan(void* ptr, const char* key, size_t key_sz, size_t num)
+{
+    thread_state* ts = static_cast<thread_state*>(ptr);
+    node* n = seek(key, key_sz, key_prefix(key, key_sz), NULL);
+
+    for (size_t i = 0; n && i < num; n = e::atomic::load_ptr_acquire(&n->next[0]))
+    {
+        const char* v = e::atomic::load_ptr_acquire(&n->val);
+
+        if (v)
+        {
+            touch(ts, v);
+            ++i;
+        }
+    }
+
+    return true;
+}
+
+int
+database_skiplist :: compare(const node* n, const char* key, size_t key_sz, uint64_t prefix)
+{
+    if (m_inline_keys && n->prefix != prefix)
+    {
+        return n->prefix < prefix ? -1 : 1;
+    }
+
+    int cmp = memcmp(n->key, key, std::min<size_t>(n->key_sz, key_sz));
+
+    if (cmp == 0 && n->key_sz != key_sz)
+    {
+        cmp = n->key_sz < key_sz ? -1 : 1;
+    }
+
+    return cmp;
+}
+
+// Returns the first node >= key, filling prevs (if non-NULL) with its
+// predecessor at each level.
+database_skiplist::node*
+database_skiplist :: seek(const char* key, size_t key_sz, uint64_t prefix, node** prevs)
+{
+    node* x = m_head;
+    node* next = NULL;
+
+    for (int level = MAX_HEIGHT - 1; level >= 0; --level)
+    {
+        while (true)
+        {
+            next = e::atomic::load_ptr_acquire(&x->next[level]);
+
+            if (!next)
+            {
+                break;
+            }
+
+            if (m_prefetch)
+            {
+                __builtin_prefetch(next->next[level]);
+            }
+
+            if (compare(next, key, key_sz, prefix) >= 0)
+            {
+                break;
+            }
+
+            x = next;
+        }
+
+        if (prevs)
+        {
+            prevs[level] = x;
+        }
+    }
+
+    return next;
+}
+
+database_skiplist::node*
+database_skiplist :: create_node(thread_state* ts, const char* key, size_t key_sz,
+                                 uint64_t prefix, unsigned height)
+{
+    const size_t node_sz = sizeof(node) + (height - 1) * sizeof(node*);
+    char* mem = allocate(ts, node_sz + (m_inline_keys ? key_sz : 0));
+    char* k = m_inline_keys ? mem + node_sz : allocate(ts, key_sz);
+
+    if (!mem || !k)
+    {
+        return NULL;
+    }
+
+    memmove(k, key, key_sz);
+    node* n = reinterpret_cast<node*>(mem);
+    n->key = k;
+    n->key_sz = key_sz;
+    n->height = height;
+    n->prefix = prefix;
+    n->val = NULL;
+
+    for (unsigned i = 0; i < height; ++i)
+    {
+        n->next[i] = NULL;
+    }
+
+    return n;
+}
+
+const char*
+database_skiplist :: create_value(thread_state* ts, const char* val, size_t val_sz)
+{
+    char* v = allocate(ts, 4 + val_sz);
+
+    if (v)
+    {
+        const uint32_t sz = val_sz;
+        memmove(v, &sz, sizeof(sz));
+        memmove(v + 4, val, val_sz);
+    }
+
+    return v;
+}
+
+char*
+database_skiplist :: allocate(thread_state* ts, size_t sz)
+{
+    // keep nodes pointer-aligned
+    sz = (sz + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+
+    if (sz > ts->left)
+    {
+        const size_t chunk_sz = sz > ARENA_CHUNK ? sz : ARENA_CHUNK;
+        char* chunk = static_cast<char*>(malloc(chunk_sz));
+
+        if (!chunk)
+        {
+            return NULL;
+        }
+
+        po6::threads::mutex::hold hold(&m_mtx);
+        m_chunks.push_back(chunk);
+        ts->cur = chunk;
+        ts->left = chunk_sz;
+    }
+
+    char* ret = ts->cur;
+    ts->cur += sz;
+    ts->left -= sz;
+    return ret;
+}
+
+void
+database_skiplist :: touch(thread_state* ts, const char* v)
+{
+    if (!v)
+    {
+        return;
+    }
+
+    uint32_t sz;
+    memmove(&sz, v, sizeof(sz));
+    ts->buf.resize(sz + 1);
+    memmove(&ts->buf[0], v + 4, sz);
+}
+
+database*
+database::create()
+{
+    return new database_skiplist();
+}
@@ -0,0 +1,575 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of this project nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <stdio.h>
+#include <string.h>
+
+// POSIX
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// STL
+#include <memory>
+#include <vector>
+
+// liburing
+#include <liburing.h>
+
+// po6
+#include <po6/errno.h>
+#include <po6/threads/mutex.h>
+
+// kvbench
+#include "database.h"
+#include "offset-reservation.h"
+
+class database_uring : public database
+{
+    public:
+        database_uring();
+        ~database_uring() throw ();
+
+    public:
+        virtual const e::argparser& parser();
+        virtual bool setup(const char* prefix);
+        virtual bool setup_thread(unsigned idx, void** ptr);
+        virtual bool teardown_thread(void* ptr);
+        virtual bool teardown();
+
+        virtual bool get(void* ptr, const char* key, size_t key_sz);
+        virtual bool put(void* ptr,
+                         const char* key, size_t key_sz,
+                         const char* val, size_t val_sz);
+        virtual bool del(void* ptr, const char* key, size_t key_sz);
+        virtual bool scan(void* ptr, const char* key, size_t key_sz, size_t num);
+
+        virtual bool setup_async(unsigned idx, void* ptr, unsigned depth,
+                                 unsigned threads, void** queue);
+        virtual bool submit(void* queue, database_op* op);
+        virtual bool poll(void* queue, unsigned min);
+        virtual bool teardown_async(void* queue);
+
+    private:
+        struct uring;
+        bool queue_write(uring* u, const char* key, size_t key_sz,
+                         const char* val, size_t val_sz, database_op* op);
+        bool reap(uring* u, unsigned min);
+        bool fail(int err);
+
+    private:
+        e::argparser m_ap;
+        bool m_fsync;
+        bool m_fixed_buffers;
+        bool m_fixed_files;
+        long m_ring_depth;
+        long m_submit_batch;
+        long m_slot_sz;
+        offset_reservation m_reserve;
+        po6::threads::mutex m_mtx;
+        int m_fd;
+
+        database_uring(const database_uring&);
+        database_uring& operator = (const database_uring&);
+};
+
+// Each thread owns a ring and ring_depth buffer slots.  A put copies its
+// record into a free slot and queues a write; the ring is submitted once
+// submit_batch writes are queued, and completions are reaped only when the
+// thread runs out of slots.  A write submitted through the asynchronous
+// calls keeps its op in "ops" and calls back when reaped.
+struct database_uring::uring
+{
+    uring();
+    ~uring() throw ();
+
+    io_uring ring;
+    bool ring_init;
+    void* reservation;
+    char* bufs;
+    size_t slot_sz;
+    std::vector<unsigned> free_slots;
+    std::vector<size_t> write_sz;
+    std::vector<database_op*> ops;
+    unsigned queued;
+    unsigned inflight;
+
+    private:
+        uring(const uring&);
+        uring& operator = (const uring&);
+};
+
+database_uring :: uring :: uring()
+    : ring()
+    , ring_init(false)
+    , reservation(NULL)
+    , bufs(NULL)
+    , slot_sz(0)
+    , free_slots()
+    , write_sz()
+    , ops()
+    , queued(0)
+    , inflight(0)
+{
+}
+
+database_uring :: uring :: ~uring() throw ()
+{
+    if (ring_init) io_uring_queue_exit(&ring);
+    if (bufs) free(bufs);
+}
+
+database_uring :: database_uring()
+    : m_ap()
+    , m_fsync(false)
+    , m_fixed_buffers(true)
+    , m_fixed_files(true)
+    , m_ring_depth(32)
+    , m_submit_batch(8)
+    , m_slot_sz(65536)
+    , m_reserve()
+    , m_mtx()
+    , m_fd(-1)
+{
+    m_ap.arg().long_name("fsync")
+              .description("link an fsync to each write and wait for it (default: no)")
+              .set_true(&m_fsync);
+    m_ap.arg().long_name("ring-depth")
+              .description("per-thread submission queue depth (default: 32)")
+              .metavar("N")
+              .as_long(&m_ring_depth);
+    m_ap.arg().long_name("submit-batch")
+              .description("submit once N writes are queued (default: 8)")
+              .metavar("N")
+              .as_long(&m_submit_batch);
+    m_ap.arg().long_name("slot-size")
+              .description("size of each per-thread write buffer (default: 65536)")
+              .metavar("BYTES")
+              .as_long(&m_slot_sz);
+    m_ap.arg().long_name("no-fixed-buffers")
+              .description("do not register the write buffers with the ring")
+              .set_false(&m_fixed_buffers);
+    m_ap.arg().long_name("no-fixed-files")
+              .description("do not register the file with the ring")
+              .set_false(&m_fixed_files);
+    m_ap.add("Offset Reservation:", m_reserve.parser());
+}
+
+database_uring :: ~database_uring() throw ()
+{
+}
+
+const e::argparser&
+database_uring :: parser()
+{
+    return m_ap;
+}
+
+bool
+database_uring :: setup(const char* prefix)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (m_ring_depth <= 0 || m_submit_batch <= 0 || m_slot_sz <= 0)
+    {
+        std::cerr << "--ring-depth, --submit-batch and --slot-size must be positive" << std::endl;
+        return false;
+    }
+
+    if (!m_reserve.setup())
+    {
+        return false;
+    }
+
+    if (m_submit_batch > m_ring_depth)
+    {
+        m_submit_batch = m_ring_depth;
+    }
+
+    std::string path = prefix;
+    path += "/file.dat";
+    m_fd = open(path.c_str(), O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR);
+
+    if (m_fd < 0)
+    {
+        perror("uring benchmark failed");
+        return false;
+    }
+
+    return true;
+}
+
+bool
+database_uring :: setup_thread(unsigned, void** ptr)
+{
+    *ptr = NULL;
+    std::auto_ptr<uring> u(new uring());
+
+    if (!m_reserve.setup_thread(&u->reservation))
+    {
+        return false;
+    }
+
+    const size_t page_sz = sysconf(_SC_PAGESIZE);
+    const unsigned depth = m_ring_depth;
+    u->slot_sz = (m_slot_sz + page_sz - 1) & ~(page_sz - 1);
+    // a linked fsync needs a second entry for every write
+    int ret = io_uring_queue_init(m_fsync ? depth * 2 : depth, &u->ring, 0);
+
+    if (ret < 0)
+    {
+        return fail(-ret);
+    }
+
+    u->ring_init = true;
+    void* bufs = NULL;
+
+    if ((ret = posix_memalign(&bufs, page_sz, u->slot_sz * depth)) != 0)
+    {
+        return fail(ret);
+    }
+
+    u->bufs = static_cast<char*>(bufs);
+    u->write_sz.resize(depth, 0);
+    u->ops.resize(depth, NULL);
+
+    for (unsigned i = 0; i < depth; ++i)
+    {
+        u->free_slots.push_back(depth - i - 1);
+    }
+
+    if (m_fixed_buffers)
+    {
+        std::vector<iovec> iov(depth);
+
+        for (unsigned i = 0; i < depth; ++i)
+        {
+            iov[i].iov_base = u->bufs + i * u->slot_sz;
+            iov[i].iov_len = u->slot_sz;
+        }
+
+        if ((ret = io_uring_register_buffers(&u->ring, &iov[0], depth)) < 0)
+        {
+            return fail(-ret);
+        }
+    }
+
+    if (m_fixed_files && (ret = io_uring_register_files(&u->ring, &m_fd, 1)) < 0)
+    {
+        return fail(-ret);
+    }
+
+    *ptr = u.release();
+    return true;
+}
+
+bool
+database_uring :: teardown_thread(void* ptr)
+{
+    uring* u = static_cast<uring*>(ptr);
+    bool ret = true;
+
+    if (u)
+    {
+        ret = reap(u, u->inflight + u->queued);
+        ret = m_reserve.teardown_thread(u->reservation) && ret;
+        delete u;
+    }
+
+    return ret;
+}
+
+bool
+database_uring :: teardown()
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    m_reserve.teardown();
+
+    if (m_fd >= 0)
+    {
+        close(m_fd);
+        m_fd = -1;
+    }
+
+    return true;
+}
+
+bool
+database_uring :: get(void* ptr, const char* key, size_t key_sz)
+{
+    abort();
+    (void) ptr;
+    (void) key;
+    (void) key_sz;
+}
+
+bool
+database_uring :: put(void* ptr,
+                      const char* key, size_t key_sz,
+                      const char* val, size_t val_sz)
+{
+    return queue_write(static_cast<uring*>(ptr), key, key_sz, val, val_sz, NULL);
+}
+
+bool
+database_uring :: del(void* ptr, const char* key, size_t key_sz)
+{
+    abort();
+    (void) ptr;
+    (void) key;
+    (void) key_sz;
+}
+
+bool
+database_uring :: scan(void* ptr, const char* key, size_t key_sz, size_t num)
+{
+    abort();
+    (void) ptr;
+    (void) key;
+    (void) key_sz;
+    (void) num;
+}
+
+// The ring is the queue.  A linked fsync completes after its write, so
+// with --fsync the writes go through the default thread pool instead.
+bool
+database_uring :: setup_async(unsigned idx, void* ptr, unsigned depth,
+                               unsigned threads, void** queue)
+{
+    if (m_fsync)
+    {
+        return database::setup_async(idx, ptr, depth, threads, queue);
+    }
+
+    *queue = ptr;
+    return true;
+}
+
+bool
+database_uring :: submit(void* queue, database_op* op)
+{
+    if (m_fsync)
+    {
+        return database::submit(queue, op);
+    }
+
+    if (op->type != 'W')
+    {
+        abort();
+    }
+
+    return queue_write(static_cast<uring*>(queue), op->key, op->key_sz, op->val, op->val_sz, op);
+}
+
+bool
+database_uring :: poll(void* queue, unsigned min)
+{
+    if (m_fsync)
+    {
+        return database::poll(queue, min);
+    }
+
+    return reap(static_cast<uring*>(queue), min);
+}
+
+bool
+database_uring :: teardown_async(void* queue)
+{
+    if (m_fsync)
+    {
+        return database::teardown_async(queue);
+    }
+
+    uring* u = static_cast<uring*>(queue);
+    return reap(u, u->inflight + u->queued);
+}
+
+bool
+database_uring :: queue_write(uring* u, const char* key, size_t key_sz,
+                              const char* val, size_t val_sz, database_op* op)
+{
+    const size_t write_sz = key_sz + val_sz;
+
+    if (write_sz > u->slot_sz)
+    {
+        std::cerr << "uring benchmark failed: record of " << write_sz
+                  << " bytes exceeds --slot-size" << std::endl;
+        return false;
+    }
+
+    if (u->free_slots.empty() && !reap(u, 1))
+    {
+        return false;
+    }
+
+    assert(!u->free_slots.empty());
+    const unsigned slot = u->free_slots.back();
+    u->free_slots.pop_back();
+    char* buf = u->bufs + slot * u->slot_sz;
+    memmove(buf, key, key_sz);
+    memmove(buf + key_sz, val, val_sz);
+    u->write_sz[slot] = write_sz;
+    u->ops[slot] = op;
+
+    const off_t off = m_reserve.reserve(u->reservation, write_sz);
+
+    const int fd = m_fixed_files ? 0 : m_fd;
+    const unsigned flags = m_fixed_files ? IOSQE_FIXED_FILE : 0;
+    io_uring_sqe* sqe = io_uring_get_sqe(&u->ring);
+    assert(sqe);
+
+    if (m_fixed_buffers)
+    {
+        io_uring_prep_write_fixed(sqe, fd, buf, write_sz, off, slot);
+    }
+    else
+    {
+        io_uring_prep_write(sqe, fd, buf, write_sz, off);
+    }
+
+    io_uring_sqe_set_flags(sqe, flags | (m_fsync ? IOSQE_IO_LINK : 0));
+    io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(slot + 1));
+    ++u->queued;
+
+    if (m_fsync)
+    {
+        sqe = io_uring_get_sqe(&u->ring);
+        assert(sqe);
+        io_uring_prep_fsync(sqe, fd, 0);
+        io_uring_sqe_set_flags(sqe, flags);
+        io_uring_sqe_set_data(sqe, NULL);
+        ++u->queued;
+        // durability means waiting for everything this thread has queued
+        return reap(u, u->inflight + u->queued);
+    }
+
+    if (u->queued >= (unsigned)m_submit_batch)
+    {
+        int ret = io_uring_submit(&u->ring);
+
+        if (ret < 0)
+        {
+            return fail(-ret);
+        }
+
+        u->inflight += u->queued;
+        u->queued = 0;
+    }
+
+    return true;
+}
+
+bool
+database_uring :: reap(uring* u, unsigned min)
+{
+    int ret = io_uring_submit_and_wait(&u->ring, min);
+
+    if (ret < 0)
+    {
+        return fail(-ret);
+    }
+
+    u->inflight += u->queued;
+    u->queued = 0;
+    bool success = true;
+    io_uring_cqe* cqe = NULL;
+
+    while (u->inflight > 0)
+    {
+        if (min > 0)
+        {
+            ret = io_uring_wait_cqe(&u->ring, &cqe);
+            --min;
+        }
+        else
+        {
+            ret = io_uring_peek_cqe(&u->ring, &cqe);
+
+            if (ret == -EAGAIN)
+            {
+                break;
+            }
+        }
+
+        if (ret < 0)
+        {
+            return fail(-ret);
+        }
+
+        const uintptr_t data = reinterpret_cast<uintptr_t>(io_uring_cqe_get_data(cqe));
+        const int res = cqe->res;
+        io_uring_cqe_seen(&u->ring, cqe);
+        --u->inflight;
+
+        if (res < 0)
+        {
+            success = fail(-res) && success;
+        }
+
+        if (data > 0)
+        {
+            const unsigned slot = data - 1;
+            bool written = res >= 0;
+
+            if (res >= 0 && (size_t)res != u->write_sz[slot])
+            {
+                std::cerr << "uring benchmark failed: short write" << std::endl;
+                written = false;
+            }
+
+            database_op* op = u->ops[slot];
+            u->ops[slot] = NULL;
+            u->free_slots.push_back(slot);
+
+            if (op)
+            {
+                op->callback(op, written);
+            }
+            else
+            {
+                success = written && success;
+            }
+        }
+    }
+
+    return success;
+}
+
+bool
+database_uring :: fail(int err)
+{
+    std::cerr << "uring benchmark failed: " << po6::strerror(err) << std::endl;
+    return false;
+}
+
+database*
+database::create()
+{
+    return new database_uring();
+}
@@ -0,0 +1,366 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of this project nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// POSIX
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// STL
+#include <vector>
+
+// po6
+#include <po6/errno.h>
+#include <po6/threads/cond.h>
+#include <po6/threads/mutex.h>
+#include <po6/time.h>
+
+// kvbench
+#include "database.h"
+
+// Group commit:  every put appends its record to the open batch.  If no
+// leader is active, the caller becomes the leader, waits up to --max-wait
+// for the batch to reach --max-batch operations, then closes the batch and
+// issues one write and one fsync for it.  Everyone else waits until the
+// batch holding their record is durable, taking over as leader for the next
+// batch if the previous leader has finished.
+// po6::threads::cond has no timed wait on CLOCK_MONOTONIC, so the leader
+// waits for its batch to fill on one of these.  A signal is remembered
+// until the next wait consumes it, so none is lost between the leader
+// dropping m_mtx and starting to wait.
+class deadline_event
+{
+    public:
+        deadline_event();
+        ~deadline_event() throw ();
+
+    public:
+        void signal();
+        // false once the monotonic clock passes deadline without a signal
+        bool wait(uint64_t deadline);
+
+    private:
+        pthread_mutex_t m_mtx;
+        pthread_cond_t m_cond;
+        bool m_signalled;
+
+    private:
+        deadline_event(const deadline_event&);
+        deadline_event& operator = (const deadline_event&);
+};
+
+class database_write_group : public database
+{
+    public:
+        database_write_group();
+        ~database_write_group() throw ();
+
+    public:
+        virtual const e::argparser& parser();
+        virtual bool setup(const char* prefix);
+        virtual bool teardown();
+
+        virtual bool get(void* ptr, const char* key, size_t key_sz);
+        virtual bool put(void* ptr,
+                         const char* key, size_t key_sz,
+                         const char* val, size_t val_sz);
+        virtual bool del(void* ptr, const char* key, size_t key_sz);
+        virtual bool scan(void* ptr, const char* key, size_t key_sz, size_t num);
+
+    private:
+        void lead();
+
+    private:
+        e::argparser m_ap;
+        bool m_fsync;
+        long m_max_batch;
+        long m_max_wait;
+        po6::threads::mutex m_mtx;
+        deadline_event m_fill;
+        po6::threads::cond m_done;
+        int m_fd;
+        // protected by m_mtx
+        std::vector<char> m_pending;
+        uint64_t m_pending_ops;
+        uint64_t m_open;
+        uint64_t m_durable;
+        bool m_leader;
+        bool m_failed;
+        uint64_t m_batches;
+        uint64_t m_ops;
+        // owned by the leader
+        std::vector<char> m_flushing;
+
+        database_write_group(const database_write_group&);
+        database_write_group& operator = (const database_write_group&);
+};
+
+database_write_group :: database_write_group()
+    : m_ap()
+    , m_fsync(true)
+    , m_max_batch(64)
+    , m_max_wait(100)
+    , m_mtx()
+    , m_fill()
+    , m_done(&m_mtx)
+    , m_fd(-1)
+    , m_pending()
+    , m_pending_ops(0)
+    , m_open(1)
+    , m_durable(0)
+    , m_leader(false)
+    , m_failed(false)
+    , m_batches(0)
+    , m_ops(0)
+    , m_flushing()
+{
+    m_ap.arg().long_name("no-fsync")
+              .description("write each batch without an fsync")
+              .set_false(&m_fsync);
+    m_ap.arg().long_name("max-batch")
+              .description("close a batch once it holds N operations (default: 64)")
+              .metavar("N")
+              .as_long(&m_max_batch);
+    m_ap.arg().long_name("max-wait")
+              .description("close a batch after the leader waits this long (default: 100)")
+              .metavar("US")
+              .as_long(&m_max_wait);
+}
+
+database_write_group :: ~database_write_group() throw ()
+{
+}
+
+const e::argparser&
+database_write_group :: parser()
+{
+    return m_ap;
+}
+
+bool
+database_write_group :: setup(const char* prefix)
+{
+    if (m_max_batch <= 0 || m_max_wait < 0)
+    {
+        std::cerr << "--max-batch must be positive and --max-wait non-negative" << std::endl;
+        return false;
+    }
+
+    std::string path = prefix;
+    path += "/file.dat";
+    m_fd = open(path.c_str(), O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR);
+
+    if (m_fd < 0)
+    {
+        perror("write-group benchmark failed");
+        return false;
+    }
+
+    return true;
+}
+
+bool
+database_write_group :: teardown()
+{
+    if (m_fd >= 0)
+    {
+        close(m_fd);
+        m_fd = -1;
+    }
+
+    if (m_batches > 0)
+    {
+        std::cerr << "group commit: " << m_ops << " operations in "
+                  << m_batches << " batches ("
+                  << double(m_ops) / m_batches << " per batch)" << std::endl;
+    }
+
+    return true;
+}
+
+bool
+database_write_group :: get(void* ptr, const char* key, size_t key_sz)
+{
+    abort();
+    (void) ptr;
+    (void) key;
+    (void) key_sz;
+}
+
+bool
+database_write_group :: put(void* ptr,
+                            const char* key, size_t key_sz,
+                            const char* val, size_t val_sz)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+    m_pending.insert(m_pending.end(), key, key + key_sz);
+    m_pending.insert(m_pending.end(), val, val + val_sz);
+    const uint64_t batch = m_open;
+
+    if (++m_pending_ops >= (uint64_t)m_max_batch)
+    {
+        m_fill.signal();
+    }
+
+    while (m_durable < batch && !m_failed)
+    {
+        if (!m_leader)
+        {
+            lead();
+        }
+        else
+        {
+            m_done.wait();
+        }
+    }
+
+    return !m_failed;
+    (void) ptr;
+}
+
+bool
+database_write_group :: del(void* ptr, const char* key, size_t key_sz)
+{
+    abort();
+    (void) ptr;
+    (void) key;
+    (void) key_sz;
+}
+
+bool
+database_write_group :: scan(void* ptr, const char* key, size_t key_sz, size_t num)
+{
+    abort();
+    (void) ptr;
+    (void) key;
+    (void) key_sz;
+    (void) num;
+}
+
+// Called with m_mtx held; returns with it held.
+void
+database_write_group :: lead()
+{
+    m_leader = true;
+
+    if (m_max_wait > 0)
+    {
+        const uint64_t deadline = po6::monotonic_time() + m_max_wait * PO6_MICROS;
+        bool filling = true;
+
+        while (filling && m_pending_ops < (uint64_t)m_max_batch)
+        {
+            m_mtx.unlock();
+            filling = m_fill.wait(deadline);
+            m_mtx.lock();
+        }
+    }
+
+    const uint64_t batch = m_open;
+    const uint64_t ops = m_pending_ops;
+    m_flushing.swap(m_pending);
+    m_pending.clear();
+    m_pending_ops = 0;
+    ++m_open;
+    m_mtx.unlock();
+
+    bool success = true;
+
+    if (write(m_fd, &m_flushing[0], m_flushing.size()) != (ssize_t)m_flushing.size() ||
+        (m_fsync && fsync(m_fd) < 0))
+    {
+        perror("write-group benchmark failed");
+        success = false;
+    }
+
+    m_mtx.lock();
+    m_durable = batch;
+    m_failed = m_failed || !success;
+    m_leader = false;
+    ++m_batches;
+    m_ops += ops;
+    m_done.broadcast();
+}
+
+deadline_event :: deadline_event()
+    : m_mtx()
+    , m_cond()
+    , m_signalled(false)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&m_mtx, NULL);
+    pthread_cond_init(&m_cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+deadline_event :: ~deadline_event() throw ()
+{
+    pthread_cond_destroy(&m_cond);
+    pthread_mutex_destroy(&m_mtx);
+}
+
+void
+deadline_event :: signal()
+{
+    pthread_mutex_lock(&m_mtx);
+    m_signalled = true;
+    pthread_cond_signal(&m_cond);
+    pthread_mutex_unlock(&m_mtx);
+}
+
+bool
+deadline_event :: wait(uint64_t deadline)
+{
+    timespec ts;
+    ts.tv_sec = deadline / PO6_SECONDS;
+    ts.tv_nsec = deadline % PO6_SECONDS;
+    pthread_mutex_lock(&m_mtx);
+
+    while (!m_signalled &&
+           pthread_cond_timedwait(&m_cond, &m_mtx, &ts) == 0)
+    {
+    }
+
+    const bool signalled = m_signalled;
+    m_signalled = false;
+    pthread_mutex_unlock(&m_mtx);
+    return signalled;
+}
+
+database*
+database::create()
+{
+    return new database_write_group();
+}
@@ -31,14 +31,23 @@
 // POSIX
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+// STL
+#include <memory>
+#include <vector>
+
 // po6
 #include <po6/errno.h>
 #include <po6/threads/mutex.h>
 
 // kvbench
 #include "database.h"
+#include "durability.h"
+#include "log-segments.h"
+
+struct write_shard;
 
 class database_write_sharded : public database
 {
@@ -48,6 +57,8 @@ class database_write_sharded : public database
 
     public:
         virtual const e::argparser& parser();
+        virtual const ygor_series** series();
+        virtual size_t series_sz();
         virtual bool setup(const char* prefix);
         virtual bool setup_thread(unsigned idx, void** ptr);
         virtual bool teardown_thread(void* ptr);
@@ -60,9 +71,17 @@ class database_write_sharded : public database
         virtual bool del(void* ptr, const char* key, size_t key_sz);
         virtual bool scan(void* ptr, const char* key, size_t key_sz, size_t num);
 
+    private:
+        bool append(write_shard* ws, const iovec* iov, int iovcnt, size_t sz, size_t ops);
+        bool flush(write_shard* ws);
+
     private:
         e::argparser m_ap;
-        bool m_fsync;
+        bool m_writev;
+        long m_combine;
+        durability m_durable;
+        log_segments m_segments;
+        const ygor_series* m_series[2];
         std::string m_prefix;
 
         database_write_sharded(const database_write_sharded&);
@@ -71,12 +90,21 @@ class database_write_sharded : public database
 
 database_write_sharded :: database_write_sharded()
     : m_ap()
-    , m_fsync(false)
+    , m_writev(false)
+    , m_combine(0)
+    , m_durable()
+    , m_segments()
     , m_prefix()
 {
-    m_ap.arg().long_name("fsync")
-              .description("perform an fsync after each write (default: no)")
-              .set_true(&m_fsync);
+    m_ap.arg().long_name("writev")
+              .description("write key and value with one writev call (default: no)")
+              .set_true(&m_writev);
+    m_ap.arg().long_name("combine")
+              .description("buffer records per thread and write them once BYTES accumulate (default: 0, off)")
+              .metavar("BYTES")
+              .as_long(&m_combine);
+    m_ap.add("Durability:", m_durable.parser());
+    m_ap.add("Segments:", m_segments.parser());
 }
 
 database_write_sharded :: ~database_write_sharded() throw ()
@@ -89,44 +117,87 @@ database_write_sharded :: parser()
     return m_ap;
 }
 
+const ygor_series**
+database_write_sharded :: series()
+{
+    m_series[0] = m_segments.series();
+    m_series[1] = m_durable.series();
+    return m_series;
+}
+
+size_t
+database_write_sharded :: series_sz()
+{
+    return m_durable.series() ? 2 : 1;
+}
+
 bool
 database_write_sharded :: setup(const char* prefix)
 {
+    if (m_combine < 0)
+    {
+        std::cerr << "--combine must be non-negative" << std::endl;
+        return false;
+    }
+
     m_prefix = prefix;
-    return true;
+    return m_durable.setup(m_dl) && m_segments.setup(m_dl);
 }
 
+struct write_shard
+{
+    write_shard() : base(), segment(0), fd(-1), off(0), tracker(), buf(), buf_ops(0) {}
+    ~write_shard() throw () { if (fd >= 0) close(fd); }
+
+    std::string base;
+    uint64_t segment;
+    int fd;
+    uint64_t off;
+    durability::tracker tracker;
+    std::vector<char> buf;
+    // records in buf
+    uint64_t buf_ops;
+
+    private:
+        write_shard(const write_shard&);
+        write_shard& operator = (const write_shard&);
+};
+
 bool
 database_write_sharded :: setup_thread(unsigned idx, void** ptr)
 {
+    *ptr = NULL;
     char buf[32];
     std::string path = m_prefix;
-    sprintf(buf, "/file-%d.dat", idx);
+    sprintf(buf, "/file-%d", idx);
     path += buf;
-    int fd = open(path.c_str(), O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR);
+    std::auto_ptr<write_shard> ws(new write_shard());
+    ws->base = path;
+    ws->buf.reserve(m_combine * 2);
 
-    if (fd < 0)
+    if (!m_segments.open_segment(ws->base, 0, m_durable.open_flags(), &ws->fd))
     {
         printf(__FILE__ ":%d %s\n", __LINE__, path.c_str());
-        perror("write-sharded benchmark failed");
         return false;
     }
 
-    *ptr = (void*)(intptr_t)fd;
+    *ptr = ws.release();
     return true;
 }
 
 bool
 database_write_sharded :: teardown_thread(void* ptr)
 {
-    int fd = (intptr_t)ptr;
+    write_shard* ws = static_cast<write_shard*>(ptr);
+    bool ret = true;
 
-    if (fd >= 0)
+    if (ws)
     {
-        close(fd);
+        ret = ws->buf.empty() || flush(ws);
+        delete ws;
     }
 
-    return true;
+    return ret;
 }
 
 bool
@@ -149,23 +220,22 @@ database_write_sharded :: put(void* ptr,
                       const char* key, size_t key_sz,
                       const char* val, size_t val_sz)
 {
-    int fd = (intptr_t)ptr;
+    write_shard* ws = static_cast<write_shard*>(ptr);
 
-    if (write(fd, key, key_sz) != (ssize_t)key_sz ||
-        write(fd, val, val_sz) != (ssize_t)val_sz)
+    if (m_combine > 0)
     {
-        perror("write-sharded benchmark failed");
-        return false;
+        ws->buf.insert(ws->buf.end(), key, key + key_sz);
+        ws->buf.insert(ws->buf.end(), val, val + val_sz);
+        ++ws->buf_ops;
+        return ws->buf.size() < (size_t)m_combine || flush(ws);
     }
 
-    if (m_fsync && fsync(fd) < 0)
-    {
-        perror("write-sharded benchmark failed");
-        return false;
-    }
-
-    return true;
-    (void) ptr;
+    iovec iov[2];
+    iov[0].iov_base = const_cast<char*>(key);
+    iov[0].iov_len = key_sz;
+    iov[1].iov_base = const_cast<char*>(val);
+    iov[1].iov_len = val_sz;
+    return append(ws, iov, 2, key_sz + val_sz, 1);
 }
 
 bool
@@ -187,6 +257,61 @@ database_write_sharded :: scan(void* ptr, const char* key, size_t key_sz, size_t
     (void) num;
 }
 
+bool
+database_write_sharded :: append(write_shard* ws, const iovec* iov, int iovcnt, size_t sz, size_t ops)
+{
+    if (m_segments.full(ws->off, sz))
+    {
+        int fd = -1;
+
+        if (!m_segments.open_segment(ws->base, ws->segment + 1, m_durable.open_flags(), &fd))
+        {
+            return false;
+        }
+
+        close(ws->fd);
+        ws->fd = fd;
+        ++ws->segment;
+        ws->off = 0;
+    }
+
+    if (m_writev)
+    {
+        if (writev(ws->fd, iov, iovcnt) != (ssize_t)sz)
+        {
+            perror("write-sharded benchmark failed");
+            return false;
+        }
+    }
+    else
+    {
+        for (int i = 0; i < iovcnt; ++i)
+        {
+            if (write(ws->fd, iov[i].iov_base, iov[i].iov_len) != (ssize_t)iov[i].iov_len)
+            {
+                perror("write-sharded benchmark failed");
+                return false;
+            }
+        }
+    }
+
+    const uint64_t off = ws->off;
+    ws->off += sz;
+    return m_durable.after_write(&ws->tracker, ws->fd, off, sz, ops);
+}
+
+bool
+database_write_sharded :: flush(write_shard* ws)
+{
+    iovec iov;
+    iov.iov_base = &ws->buf[0];
+    iov.iov_len = ws->buf.size();
+    bool ret = append(ws, &iov, 1, ws->buf.size(), ws->buf_ops);
+    ws->buf.clear();
+    ws->buf_ops = 0;
+    return ret;
+}
+
 database*
 database::create()
 {
@@ -26,19 +26,29 @@
 // POSSIBILITY OF SUCH DAMAGE.
 
 // C
+#include <limits.h>
 #include <stdio.h>
 
 // POSIX
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+// STL
+#include <algorithm>
+#include <vector>
+
 // po6
 #include <po6/errno.h>
 #include <po6/threads/mutex.h>
 
 // kvbench
 #include "database.h"
+#include "durability.h"
+#include "log-segments.h"
+
+struct combine_buffer;
 
 class database_write : public database
 {
@@ -48,7 +58,11 @@ class database_write : public database
 
     public:
         virtual const e::argparser& parser();
+        virtual const ygor_series** series();
+        virtual size_t series_sz();
         virtual bool setup(const char* prefix);
+        virtual bool setup_thread(unsigned idx, void** ptr);
+        virtual bool teardown_thread(void* ptr);
         virtual bool teardown();
 
         virtual bool get(void* ptr, const char* key, size_t key_sz);
@@ -58,25 +72,72 @@ class database_write : public database
         virtual bool del(void* ptr, const char* key, size_t key_sz);
         virtual bool scan(void* ptr, const char* key, size_t key_sz, size_t num);
 
+        virtual bool multi_put(void* ptr, size_t num,
+                               const char* const* keys, const size_t* key_szs,
+                               const char* const* vals, const size_t* val_szs);
+
+    private:
+        bool append(const iovec* iov, int iovcnt, size_t sz, size_t ops);
+        bool flush(combine_buffer* cb);
+        bool roll();
+
     private:
         e::argparser m_ap;
-        bool m_fsync;
+        bool m_writev;
+        long m_combine;
+        durability m_durable;
+        durability::tracker m_tracker;
+        log_segments m_segments;
+        const ygor_series* m_series[2];
         po6::threads::mutex m_mtx;
+        std::string m_base;
+        uint64_t m_segment;
+        uint64_t m_off;
         int m_fd;
+        // finished segments; other threads may still be syncing them
+        std::vector<int> m_retired;
 
         database_write(const database_write&);
         database_write& operator = (const database_write&);
 };
 
+// a thread's --combine buffer and the number of records in it
+struct combine_buffer
+{
+    combine_buffer() : buf(), ops(0) {}
+    ~combine_buffer() throw () {}
+
+    std::vector<char> buf;
+    uint64_t ops;
+
+    private:
+        combine_buffer(const combine_buffer&);
+        combine_buffer& operator = (const combine_buffer&);
+};
+
 database_write :: database_write()
     : m_ap()
-    , m_fsync(false)
+    , m_writev(false)
+    , m_combine(0)
+    , m_durable()
+    , m_tracker()
+    , m_segments()
     , m_mtx()
+    , m_base()
+    , m_segment(0)
+    , m_off(0)
     , m_fd(-1)
+    , m_retired()
 {
-    m_ap.arg().long_name("fsync")
-              .description("perform an fsync after each write (default: no)")
-              .set_true(&m_fsync);
+    m_ap.arg().long_name("writev")
+              .description("write key and value with one writev call (default: no)")
+              .set_true(&m_writev);
+    m_ap.arg().long_name("combine")
+              .description("buffer records per thread and write them once BYTES accumulate (default: 0, off)")
+              .metavar("BYTES")
+              .as_long(&m_combine);
+    m_ap.add("Durability:", m_durable.parser());
+    m_ap.add("Segments:", m_segments.parser());
 }
 
 database_write :: ~database_write() throw ()
@@ -89,23 +150,71 @@ database_write :: parser()
     return m_ap;
 }
 
+const ygor_series**
+database_write :: series()
+{
+    m_series[0] = m_segments.series();
+    m_series[1] = m_durable.series();
+    return m_series;
+}
+
+size_t
+database_write :: series_sz()
+{
+    return m_durable.series() ? 2 : 1;
+}
+
 bool
 database_write :: setup(const char* prefix)
 {
     po6::threads::mutex::hold hold(&m_mtx);
-    std::string path = prefix;
-    path += "/file.dat";
-    m_fd = open(path.c_str(), O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR);
 
-    if (m_fd < 0)
+    if (m_combine < 0)
+    {
+        std::cerr << "--combine must be non-negative" << std::endl;
+        return false;
+    }
+
+    if (!m_durable.setup(m_dl) || !m_segments.setup(m_dl))
     {
-        perror("write benchmark failed");
         return false;
     }
 
+    m_base = prefix;
+    m_base += "/file";
+    return m_segments.open_segment(m_base, 0, m_durable.open_flags(), &m_fd);
+}
+
+bool
+database_write :: setup_thread(unsigned, void** ptr)
+{
+    *ptr = NULL;
+
+    if (m_combine > 0)
+    {
+        combine_buffer* cb = new combine_buffer();
+        cb->buf.reserve(m_combine * 2);
+        *ptr = cb;
+    }
+
     return true;
 }
 
+bool
+database_write :: teardown_thread(void* ptr)
+{
+    combine_buffer* cb = static_cast<combine_buffer*>(ptr);
+    bool ret = true;
+
+    if (cb)
+    {
+        ret = cb->buf.empty() || flush(cb);
+        delete cb;
+    }
+
+    return ret;
+}
+
 bool
 database_write :: teardown()
 {
@@ -117,6 +226,12 @@ database_write :: teardown()
         m_fd = -1;
     }
 
+    for (size_t i = 0; i < m_retired.size(); ++i)
+    {
+        close(m_retired[i]);
+    }
+
+    m_retired.clear();
     return true;
 }
 
@@ -134,25 +249,21 @@ database_write :: put(void* ptr,
                       const char* key, size_t key_sz,
                       const char* val, size_t val_sz)
 {
+    if (m_combine > 0)
     {
-        po6::threads::mutex::hold hold(&m_mtx);
-
-        if (write(m_fd, key, key_sz) != (ssize_t)key_sz ||
-            write(m_fd, val, val_sz) != (ssize_t)val_sz)
-        {
-            perror("write benchmark failed");
-            return false;
-        }
-    }
-
-    if (m_fsync && fsync(m_fd) < 0)
-    {
-        perror("write benchmark failed");
-        return false;
+        combine_buffer* cb = static_cast<combine_buffer*>(ptr);
+        cb->buf.insert(cb->buf.end(), key, key + key_sz);
+        cb->buf.insert(cb->buf.end(), val, val + val_sz);
+        ++cb->ops;
+        return cb->buf.size() < (size_t)m_combine || flush(cb);
     }
 
-    return true;
-    (void) ptr;
+    iovec iov[2];
+    iov[0].iov_base = const_cast<char*>(key);
+    iov[0].iov_len = key_sz;
+    iov[1].iov_base = const_cast<char*>(val);
+    iov[1].iov_len = val_sz;
+    return append(iov, 2, key_sz + val_sz, 1);
 }
 
 bool
@@ -174,6 +285,124 @@ database_write :: scan(void* ptr, const char* key, size_t key_sz, size_t num)
     (void) num;
 }
 
+// One append per IOV_MAX / 2 records, so that with --writev a batch is a
+// single system call.  With --combine the records go through the buffer.
+bool
+database_write :: multi_put(void* ptr, size_t num,
+                            const char* const* keys, const size_t* key_szs,
+                            const char* const* vals, const size_t* val_szs)
+{
+    if (m_combine > 0)
+    {
+        return database::multi_put(ptr, num, keys, key_szs, vals, val_szs);
+    }
+
+    std::vector<iovec> iov;
+    iov.reserve(2 * std::min(num, (size_t)IOV_MAX / 2));
+    size_t sz = 0;
+    size_t ops = 0;
+
+    for (size_t i = 0; i < num; ++i)
+    {
+        iovec k;
+        k.iov_base = const_cast<char*>(keys[i]);
+        k.iov_len = key_szs[i];
+        iovec v;
+        v.iov_base = const_cast<char*>(vals[i]);
+        v.iov_len = val_szs[i];
+        iov.push_back(k);
+        iov.push_back(v);
+        sz += key_szs[i] + val_szs[i];
+        ++ops;
+
+        if (iov.size() + 2 > (size_t)IOV_MAX || i + 1 == num)
+        {
+            if (!append(&iov[0], iov.size(), sz, ops))
+            {
+                return false;
+            }
+
+            iov.clear();
+            sz = 0;
+            ops = 0;
+        }
+    }
+
+    return true;
+}
+
+bool
+database_write :: append(const iovec* iov, int iovcnt, size_t sz, size_t ops)
+{
+    uint64_t off = 0;
+    int fd = -1;
+
+    {
+        po6::threads::mutex::hold hold(&m_mtx);
+
+        if (m_segments.full(m_off, sz) && !roll())
+        {
+            return false;
+        }
+
+        if (m_writev)
+        {
+            if (writev(m_fd, iov, iovcnt) != (ssize_t)sz)
+            {
+                perror("write benchmark failed");
+                return false;
+            }
+        }
+        else
+        {
+            for (int i = 0; i < iovcnt; ++i)
+            {
+                if (write(m_fd, iov[i].iov_base, iov[i].iov_len) != (ssize_t)iov[i].iov_len)
+                {
+                    perror("write benchmark failed");
+                    return false;
+                }
+            }
+        }
+
+        fd = m_fd;
+        off = m_off;
+        m_off += sz;
+    }
+
+    return m_durable.after_write(&m_tracker, fd, off, sz, ops);
+}
+
+bool
+database_write :: flush(combine_buffer* cb)
+{
+    iovec iov;
+    iov.iov_base = &cb->buf[0];
+    iov.iov_len = cb->buf.size();
+    bool ret = append(&iov, 1, cb->buf.size(), cb->ops);
+    cb->buf.clear();
+    cb->ops = 0;
+    return ret;
+}
+
+// Called with m_mtx held.
+bool
+database_write :: roll()
+{
+    int fd = -1;
+
+    if (!m_segments.open_segment(m_base, m_segment + 1, m_durable.open_flags(), &fd))
+    {
+        return false;
+    }
+
+    m_retired.push_back(m_fd);
+    m_fd = fd;
+    ++m_segment;
+    m_off = 0;
+    return true;
+}
+
 database*
 database::create()
 {
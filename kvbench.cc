@@ -25,8 +25,17 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+// C
+#include <string.h>
+
+// POSIX
+#include <sys/stat.h>
+#include <sys/types.h>
+
 // STL
 #include <memory>
+#include <string>
+#include <vector>
 
 // po6
 #include <po6/errno.h>
@@ -42,32 +51,119 @@
 
 // kvbench
 #include "database.h"
+#include "plugin.h"
 #include "workload.h"
 
-int
-main(int argc, const char* argv[])
+static void
+usage(const char* argv0)
 {
-    if (argc < 2)
+    std::cerr << "Usage: " << argv0 << " <workload> --db=<name>[,<name>...] [OPTION...]" << std::endl;
+    std::cerr << "       " << argv0 << " --list-dbs [--plugin-dir=DIR]" << std::endl;
+    std::cerr << "Options for one database alone are given as --<name>.<option>" << std::endl;
+}
+
+// The database must be loaded before the command line can be parsed, so
+// the options that choose it are found ahead of the parser.
+static const char*
+find_option(int argc, const char* argv[], const char* name)
+{
+    const size_t name_sz = strlen(name);
+
+    for (int i = 1; i < argc; ++i)
     {
-        std::cerr << "Usage: " << argv[0] << " <workload> [OPTION...]" << std::endl;
-        return EXIT_FAILURE;
+        if (strncmp(argv[i], name, name_sz) != 0)
+        {
+            continue;
+        }
+
+        if (argv[i][name_sz] == '=')
+        {
+            return argv[i] + name_sz + 1;
+        }
+
+        if (argv[i][name_sz] == '\0')
+        {
+            return i + 1 < argc ? argv[i + 1] : "";
+        }
     }
 
+    return NULL;
+}
+
+// Options written --<name>.<option> belong to the database called name.
+// They are passed on as --<option> to that database and dropped, along
+// with any separate value, for the others.
+static void
+scope_options(int argc, const char* argv[],
+              const std::vector<std::string>& names, const std::string& name,
+              std::vector<std::string>* args)
+{
+    args->clear();
+
+    for (int i = 0; i < argc; ++i)
+    {
+        std::string arg(argv[i]);
+        size_t which = names.size();
+
+        for (size_t n = 0; i > 1 && n < names.size(); ++n)
+        {
+            const std::string prefix("--" + names[n] + ".");
+
+            if (arg.compare(0, prefix.size(), prefix) == 0)
+            {
+                which = n;
+                break;
+            }
+        }
+
+        if (which == names.size())
+        {
+            args->push_back(arg);
+        }
+        else if (names[which] == name)
+        {
+            args->push_back("--" + arg.substr(names[which].size() + 3));
+        }
+        else if (arg.find('=') == std::string::npos &&
+                 i + 1 < argc && argv[i + 1][0] != '-')
+        {
+            ++i;
+        }
+    }
+}
+
+// Runs the workload against one database.  When several are run back to
+// back, each writes to <name>-<output> and keeps its data in <dir>/<name>.
+static bool
+run(int argc, const char* argv[], const char* plugin_dir,
+    const std::vector<std::string>& names, size_t idx)
+{
+    const std::string& name(names[idx]);
+    const bool several = names.size() > 1;
+    plugin p;
+
+    if (!p.load(plugin_dir, name))
+    {
+        return false;
+    }
+
+    // declared after the plugin so that it is destroyed first
+    const std::auto_ptr<database> db(p.create());
     const std::auto_ptr<workload> work(workload::create(argv[1]));
-    const std::auto_ptr<database> db(database::create());
-    assert(db.get());
+    assert(work.get());
 
-    if (!work.get())
+    if (!db.get())
     {
-        std::cerr << "Unknown workload " << argv[1] << std::endl;
-        std::cerr << "Usage: " << argv[0] << " <workload> [OPTION...]" << std::endl;
-        return EXIT_FAILURE;
+        std::cerr << "could not create database " << name << std::endl;
+        return false;
     }
 
     const char* output = "benchmark.dat";
     const char* dir = "tmp";
+    const char* dbs = NULL;
     long num_threads = 1;
     bool stats = true;
+    bool list = false;
 
     e::argparser ap;
     ap.autohelp();
@@ -84,43 +180,161 @@ main(int argc, const char* argv[])
     ap.arg().long_name("no-stats")
             .description("don't collect local system stats")
             .set_false(&stats);
+    ap.arg().long_name("db")
+            .description("comma-separated databases to run the workload against, in order")
+            .metavar("NAME")
+            .as_string(&dbs);
+    ap.arg().long_name("plugin-dir")
+            .description("directory holding the database plugins")
+            .metavar("DIR")
+            .as_string(&plugin_dir);
+    ap.arg().long_name("list-dbs")
+            .description("list the available databases and exit")
+            .set_true(&list);
     ap.add("Database Specific Options:", db->parser());
     ap.add("Workload Specific Options:", work->parser());
 
-    if (!ap.parse(argc - 1, argv + 1))
+    std::vector<std::string> args;
+    scope_options(argc, argv, names, name, &args);
+    std::vector<const char*> scoped;
+
+    for (size_t i = 0; i < args.size(); ++i)
     {
-        return EXIT_FAILURE;
+        scoped.push_back(args[i].c_str());
     }
 
-    ygor_data_logger* dl = ygor_data_logger_create(output, work->series(), work->series_sz());
+    if (!ap.parse(scoped.size() - 1, &scoped[1]))
+    {
+        return false;
+    }
+
+    std::string out_path(output);
+    std::string dir_path(dir);
+
+    if (several)
+    {
+        out_path = name + "-" + out_path;
+        dir_path += "/" + name;
+
+        if ((mkdir(dir, S_IRWXU) < 0 && errno != EEXIST) ||
+            (mkdir(dir_path.c_str(), S_IRWXU) < 0 && errno != EEXIST))
+        {
+            std::cerr << "could not create " << dir_path << ": " << po6::strerror(errno) << std::endl;
+            return false;
+        }
+    }
+
+    std::vector<const ygor_series*> series(work->series(), work->series() + work->series_sz());
+    series.insert(series.end(), db->series(), db->series() + db->series_sz());
+    ygor_data_logger* dl = ygor_data_logger_create(out_path.c_str(), &series[0], series.size());
 
     if (!dl)
     {
         std::cerr << "could not open output: " << po6::strerror(errno) << std::endl;
-        return EXIT_FAILURE;
+        return false;
     }
 
-    if (!db->setup(dir))
+    db->set_data_logger(dl);
+
+    if (!db->setup(dir_path.c_str()))
     {
-        return EXIT_FAILURE;
+        ygor_data_logger_flush_and_destroy(dl);
+        return false;
     }
 
-    int rc = EXIT_SUCCESS;
+    bool ret = true;
 
     if (!work->run(db.get(), dl, num_threads))
     {
-        rc = EXIT_FAILURE;
+        ret = false;
     }
 
     if (!db->teardown())
     {
-        rc = EXIT_FAILURE;
+        ret = false;
     }
 
     if (ygor_data_logger_flush_and_destroy(dl) < 0)
     {
         std::cerr << "could not close output: " << po6::strerror(errno) << std::endl;
-        rc = EXIT_FAILURE;
+        ret = false;
+    }
+
+    return ret;
+}
+
+int
+main(int argc, const char* argv[])
+{
+    const char* plugin_dir = find_option(argc, argv, "--plugin-dir");
+    plugin_dir = plugin_dir ? plugin_dir : plugin::default_dir();
+
+    if (find_option(argc, argv, "--list-dbs"))
+    {
+        std::vector<std::string> names;
+
+        if (!plugin::list(plugin_dir, &names))
+        {
+            return EXIT_FAILURE;
+        }
+
+        for (size_t i = 0; i < names.size(); ++i)
+        {
+            std::cout << names[i] << std::endl;
+        }
+
+        return EXIT_SUCCESS;
+    }
+
+    if (argc < 2)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const std::auto_ptr<workload> work(workload::create(argv[1]));
+
+    if (!work.get())
+    {
+        std::cerr << "Unknown workload " << argv[1] << std::endl;
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const char* dbs = find_option(argc, argv, "--db");
+
+    if (!dbs || !*dbs)
+    {
+        std::cerr << "no database given; --list-dbs shows those available" << std::endl;
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    std::vector<std::string> names;
+    std::string all(dbs);
+    size_t start = 0;
+
+    while (start <= all.size())
+    {
+        size_t end = all.find(',', start);
+        end = end == std::string::npos ? all.size() : end;
+
+        if (end > start)
+        {
+            names.push_back(all.substr(start, end - start));
+        }
+
+        start = end + 1;
+    }
+
+    int rc = EXIT_SUCCESS;
+
+    for (size_t i = 0; i < names.size(); ++i)
+    {
+        if (!run(argc, argv, plugin_dir, names, i))
+        {
+            rc = EXIT_FAILURE;
+        }
     }
 
     return rc;
@@ -0,0 +1,309 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of this project nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <stdio.h>
+#include <stdlib.h>
+
+// POSIX
+#include <unistd.h>
+
+// STL
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+
+// po6
+#include <po6/time.h>
+
+// e
+#include <e/atomic.h>
+
+// kvbench
+#include "leveldb-stats.h"
+
+leveldb_stats :: leveldb_stats()
+    : m_ap()
+    , m_interval(0)
+    , m_names()
+    , m_level()
+    , m_memory()
+    , m_series()
+    , m_dl(NULL)
+    , m_dbs()
+    , m_thread()
+    , m_stop(0)
+    , m_failed(0)
+{
+    m_ap.arg().long_name("stats-interval")
+              .description("sample LevelDB's internal statistics every T milliseconds; 0 disables (default: 0)")
+              .metavar("T")
+              .as_long(&m_interval);
+
+    static const char* suffixes[PER_LEVEL] = {
+        "files", "bytes", "compaction-read", "compaction-write"
+    };
+    static const ygor_units units[PER_LEVEL] = {
+        YGOR_UNIT_UNIT, YGOR_UNIT_BYTES, YGOR_UNIT_MBYTES, YGOR_UNIT_MBYTES
+    };
+    static const ygor_precision precisions[PER_LEVEL] = {
+        YGOR_PRECISE_INTEGER, YGOR_PRECISE_INTEGER, YGOR_SINGLE_PRECISION, YGOR_SINGLE_PRECISION
+    };
+
+    for (unsigned level = 0; level < LEVELDB_STATS_LEVELS; ++level)
+    {
+        for (unsigned i = 0; i < PER_LEVEL; ++i)
+        {
+            snprintf(m_names[level][i], sizeof(m_names[level][i]),
+                     "level%u-%s", level, suffixes[i]);
+            ygor_series* s = &m_level[level][i];
+            s->name = m_names[level][i];
+            s->indep_units = YGOR_UNIT_MS;
+            s->indep_precision = YGOR_PRECISE_INTEGER;
+            s->dep_units = units[i];
+            s->dep_precision = precisions[i];
+            m_series[level * PER_LEVEL + i] = s;
+        }
+    }
+
+    m_memory.name = "memory";
+    m_memory.indep_units = YGOR_UNIT_MS;
+    m_memory.indep_precision = YGOR_PRECISE_INTEGER;
+    m_memory.dep_units = YGOR_UNIT_BYTES;
+    m_memory.dep_precision = YGOR_PRECISE_INTEGER;
+    m_series[LEVELDB_STATS_LEVELS * PER_LEVEL] = &m_memory;
+}
+
+leveldb_stats :: ~leveldb_stats() throw ()
+{
+}
+
+const e::argparser&
+leveldb_stats :: parser()
+{
+    return m_ap;
+}
+
+const ygor_series**
+leveldb_stats :: series()
+{
+    return m_series;
+}
+
+size_t
+leveldb_stats :: series_sz()
+{
+    return m_interval > 0 ? sizeof(m_series) / sizeof(m_series[0]) : 0;
+}
+
+bool
+leveldb_stats :: setup(ygor_data_logger* dl, const std::vector<leveldb::DB*>& dbs)
+{
+    if (m_interval < 0)
+    {
+        std::cerr << "--stats-interval must be non-negative" << std::endl;
+        return false;
+    }
+
+    if (m_interval == 0 || !dl)
+    {
+        return true;
+    }
+
+    m_dl = dl;
+    m_dbs = dbs;
+    e::atomic::store_32_release(&m_stop, 0);
+    e::atomic::store_32_release(&m_failed, 0);
+    using namespace po6::threads;
+    m_thread.reset(new thread(make_obj_func(&leveldb_stats::run, this)));
+    m_thread->start();
+    return true;
+}
+
+// Must be called before the databases are closed.
+bool
+leveldb_stats :: teardown()
+{
+    if (m_thread.get())
+    {
+        e::atomic::store_32_release(&m_stop, 1);
+        m_thread->join();
+        m_thread.reset();
+    }
+
+    return e::atomic::load_32_acquire(&m_failed) == 0;
+}
+
+void
+leveldb_stats :: run()
+{
+    uint64_t next = po6::monotonic_time();
+
+    while (!e::atomic::load_32_acquire(&m_stop))
+    {
+        const uint64_t now = po6::monotonic_time();
+
+        if (now >= next)
+        {
+            if (!sample(now))
+            {
+                e::atomic::store_32_release(&m_failed, 1);
+                return;
+            }
+
+            next = now + m_interval * PO6_MILLIS;
+            continue;
+        }
+
+        // wake often enough that teardown is not held up by long intervals
+        usleep(std::min<uint64_t>(next - now, 10 * PO6_MILLIS) / PO6_MICROS);
+    }
+}
+
+bool
+leveldb_stats :: sample(uint64_t now)
+{
+    uint64_t files[LEVELDB_STATS_LEVELS] = {0};
+    uint64_t bytes[LEVELDB_STATS_LEVELS] = {0};
+    double compaction_read[LEVELDB_STATS_LEVELS] = {0};
+    double compaction_write[LEVELDB_STATS_LEVELS] = {0};
+    uint64_t memory = 0;
+
+    for (size_t i = 0; i < m_dbs.size(); ++i)
+    {
+        std::string prop;
+        std::string line;
+
+        // lines of " <number>:<size>[<smallest> .. <largest>]" under a
+        // "--- level N ---" heading
+        if (m_dbs[i]->GetProperty("leveldb.sstables", &prop))
+        {
+            std::istringstream in(prop);
+            int level = -1;
+
+            while (std::getline(in, line))
+            {
+                int l = 0;
+                unsigned long long number = 0;
+                unsigned long long size = 0;
+
+                if (sscanf(line.c_str(), "--- level %d ---", &l) == 1)
+                {
+                    level = l;
+                }
+                else if (level >= 0 && level < LEVELDB_STATS_LEVELS &&
+                         sscanf(line.c_str(), " %llu:%llu", &number, &size) == 2)
+                {
+                    ++files[level];
+                    bytes[level] += size;
+                }
+            }
+        }
+
+        // a table of "Level Files Size(MB) Time(sec) Read(MB) Write(MB)"
+        if (m_dbs[i]->GetProperty("leveldb.stats", &prop))
+        {
+            std::istringstream in(prop);
+
+            while (std::getline(in, line))
+            {
+                int level = 0;
+                int f = 0;
+                double size = 0;
+                double time = 0;
+                double read = 0;
+                double write = 0;
+
+                if (sscanf(line.c_str(), "%d %d %lf %lf %lf %lf",
+                           &level, &f, &size, &time, &read, &write) == 6 &&
+                    level >= 0 && level < LEVELDB_STATS_LEVELS)
+                {
+                    compaction_read[level] += read;
+                    compaction_write[level] += write;
+                }
+            }
+        }
+
+        if (m_dbs[i]->GetProperty("leveldb.approximate-memory-usage", &prop))
+        {
+            memory += strtoull(prop.c_str(), NULL, 10);
+        }
+    }
+
+    for (unsigned level = 0; level < LEVELDB_STATS_LEVELS; ++level)
+    {
+        ygor_data_value v;
+        v.precise = files[level];
+
+        if (!record(&m_level[level][FILES], now, v))
+        {
+            return false;
+        }
+
+        v.precise = bytes[level];
+
+        if (!record(&m_level[level][BYTES], now, v))
+        {
+            return false;
+        }
+
+        v.approximate = compaction_read[level];
+
+        if (!record(&m_level[level][COMPACTION_READ], now, v))
+        {
+            return false;
+        }
+
+        v.approximate = compaction_write[level];
+
+        if (!record(&m_level[level][COMPACTION_WRITE], now, v))
+        {
+            return false;
+        }
+    }
+
+    ygor_data_value v;
+    v.precise = memory;
+    return record(&m_memory, now, v);
+}
+
+bool
+leveldb_stats :: record(const ygor_series* s, uint64_t now, const ygor_data_value& v)
+{
+    ygor_data_point dp;
+    dp.series = s;
+    dp.indep.precise = now / PO6_MILLIS;
+    dp.dep = v;
+
+    if (ygor_data_logger_record(m_dl, &dp) < 0)
+    {
+        std::cerr << "could not record LevelDB statistics" << std::endl;
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,96 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of this project nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef kvbench_leveldb_stats_h_
+#define kvbench_leveldb_stats_h_
+
+// C
+#include <stdint.h>
+
+// STL
+#include <memory>
+#include <vector>
+
+// po6
+#include <po6/threads/thread.h>
+
+// e
+#include <e/popt.h>
+
+// ygor
+#include <ygor/data.h>
+
+// LevelDB
+#include <leveldb/db.h>
+
+#define LEVELDB_STATS_LEVELS 7
+
+// Samples LevelDB's internal statistics from a background thread every
+// --stats-interval milliseconds and records them as series alongside the
+// workload's latencies.  Each level gets a file count and byte total
+// (from "leveldb.sstables") and cumulative compaction read and write
+// volume (from "leveldb.stats"); "memory" records
+// "leveldb.approximate-memory-usage", which covers the memtables and the
+// block cache.  With several instances the values are summed.
+class leveldb_stats
+{
+    public:
+        leveldb_stats();
+        ~leveldb_stats() throw ();
+
+    public:
+        const e::argparser& parser();
+        const ygor_series** series();
+        size_t series_sz();
+        bool setup(ygor_data_logger* dl, const std::vector<leveldb::DB*>& dbs);
+        bool teardown();
+
+    private:
+        enum { FILES, BYTES, COMPACTION_READ, COMPACTION_WRITE, PER_LEVEL };
+        void run();
+        bool sample(uint64_t now);
+        bool record(const ygor_series* s, uint64_t now, const ygor_data_value& v);
+
+    private:
+        e::argparser m_ap;
+        long m_interval;
+        char m_names[LEVELDB_STATS_LEVELS][PER_LEVEL][32];
+        ygor_series m_level[LEVELDB_STATS_LEVELS][PER_LEVEL];
+        ygor_series m_memory;
+        const ygor_series* m_series[LEVELDB_STATS_LEVELS * PER_LEVEL + 1];
+        ygor_data_logger* m_dl;
+        std::vector<leveldb::DB*> m_dbs;
+        std::auto_ptr<po6::threads::thread> m_thread;
+        uint32_t m_stop;
+        uint32_t m_failed;
+
+    private:
+        leveldb_stats(const leveldb_stats&);
+        leveldb_stats& operator = (const leveldb_stats&);
+};
+
+#endif // kvbench_leveldb_stats_h_
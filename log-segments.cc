@@ -0,0 +1,345 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of this project nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <stdio.h>
+
+// POSIX
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// STL
+#include <algorithm>
+#include <iostream>
+
+// po6
+#include <po6/time.h>
+
+// e
+#include <e/atomic.h>
+
+// kvbench
+#include "log-segments.h"
+
+// a table can address this many segments
+#define MAX_SEGMENTS 65536
+
+log_segments :: table :: table()
+    : m_base()
+    , m_flags(0)
+    , m_fds()
+    , m_mtx()
+{
+}
+
+log_segments :: table :: ~table() throw ()
+{
+}
+
+log_segments :: log_segments()
+    : m_ap()
+    , m_segment_mb(0)
+    , m_preallocate(false)
+    , m_segment_sz(0)
+    , m_series()
+    , m_dl(NULL)
+{
+    m_ap.arg().long_name("segment-size")
+              .description("roll over to a new file every MB megabytes; 0 for one file (default: 0)")
+              .metavar("MB")
+              .as_long(&m_segment_mb);
+    m_ap.arg().long_name("preallocate")
+              .description("fallocate each segment when it is opened (default: no)")
+              .set_true(&m_preallocate);
+
+    m_series.name = "rollover";
+    m_series.indep_units = YGOR_UNIT_MS;
+    m_series.indep_precision = YGOR_PRECISE_INTEGER;
+    m_series.dep_units = YGOR_UNIT_MS;
+    m_series.dep_precision = YGOR_HALF_PRECISION;
+}
+
+log_segments :: ~log_segments() throw ()
+{
+}
+
+const e::argparser&
+log_segments :: parser()
+{
+    return m_ap;
+}
+
+const ygor_series*
+log_segments :: series()
+{
+    return &m_series;
+}
+
+bool
+log_segments :: setup(ygor_data_logger* dl)
+{
+    m_dl = dl;
+
+    if (m_segment_mb < 0)
+    {
+        std::cerr << "--segment-size must be non-negative" << std::endl;
+        return false;
+    }
+
+    if (m_preallocate && m_segment_mb == 0)
+    {
+        std::cerr << "--preallocate requires --segment-size" << std::endl;
+        return false;
+    }
+
+    m_segment_sz = uint64_t(m_segment_mb) << 20;
+    return true;
+}
+
+bool
+log_segments :: open_segment(const std::string& base, uint64_t idx, int flags, int* fd)
+{
+    const uint64_t start = po6::monotonic_time();
+    std::string path = base;
+
+    if (m_segment_sz > 0)
+    {
+        char buf[32];
+        sprintf(buf, "-%05llu.dat", (unsigned long long)idx);
+        path += buf;
+    }
+    else
+    {
+        path += ".dat";
+    }
+
+    *fd = open(path.c_str(), O_RDWR|O_CREAT|O_TRUNC|flags, S_IRUSR|S_IWUSR);
+
+    if (*fd < 0)
+    {
+        perror("could not open segment");
+        return false;
+    }
+
+    if (m_preallocate && fallocate(*fd, 0, 0, m_segment_sz) < 0)
+    {
+        perror("could not preallocate segment");
+        close(*fd);
+        *fd = -1;
+        return false;
+    }
+
+    if (m_dl && idx > 0)
+    {
+        const uint64_t end = po6::monotonic_time();
+        ygor_data_point dp;
+        dp.series = &m_series;
+        dp.indep.precise = end / PO6_MILLIS;
+        dp.dep.approximate = (end - start) / (double)PO6_MILLIS;
+
+        if (ygor_data_logger_record(m_dl, &dp) < 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool
+log_segments :: open_table(table* t, const std::string& base, int flags)
+{
+    t->m_base = base;
+    t->m_flags = flags;
+    t->m_fds.resize(m_segment_sz > 0 ? MAX_SEGMENTS : 1, 0);
+    return lookup(t, 0) >= 0;
+}
+
+// A record that straddles a boundary is written, and synced, in pieces,
+// one per segment.
+bool
+log_segments :: pwrite(table* t, const iovec* iov, int iovcnt, uint64_t off,
+                       durability* d, durability::tracker* dt)
+{
+    const uint64_t start = off;
+
+    for (int i = 0; i < iovcnt; ++i)
+    {
+        const char* buf = static_cast<const char*>(iov[i].iov_base);
+        size_t sz = iov[i].iov_len;
+
+        while (sz > 0)
+        {
+            int fd = -1;
+            uint64_t seg_off = 0;
+            const size_t chunk = piece(t, off, sz, &fd, &seg_off);
+
+            if (chunk == 0)
+            {
+                return false;
+            }
+
+            if (::pwrite(fd, buf, chunk, seg_off) != (ssize_t)chunk)
+            {
+                perror("segment write failed");
+                return false;
+            }
+
+            buf += chunk;
+            sz -= chunk;
+            off += chunk;
+        }
+    }
+
+    if (!d->due(dt, 1))
+    {
+        return true;
+    }
+
+    for (uint64_t pos = start; pos < off; )
+    {
+        int fd = -1;
+        uint64_t seg_off = 0;
+        const size_t chunk = piece(t, pos, off - pos, &fd, &seg_off);
+
+        if (chunk == 0 || !d->sync(fd, seg_off, chunk))
+        {
+            return false;
+        }
+
+        pos += chunk;
+    }
+
+    return true;
+}
+
+bool
+log_segments :: pread(table* t, char* buf, size_t sz, uint64_t off)
+{
+    while (sz > 0)
+    {
+        uint64_t idx = 0;
+        uint64_t seg_off = off;
+        size_t chunk = sz;
+
+        if (m_segment_sz > 0)
+        {
+            idx = off / m_segment_sz;
+            seg_off = off % m_segment_sz;
+            chunk = std::min<uint64_t>(sz, m_segment_sz - seg_off);
+        }
+
+        int fd = lookup(t, idx);
+
+        if (fd < 0)
+        {
+            return false;
+        }
+
+        if (::pread(fd, buf, chunk, seg_off) != (ssize_t)chunk)
+        {
+            perror("segment read failed");
+            return false;
+        }
+
+        buf += chunk;
+        sz -= chunk;
+        off += chunk;
+    }
+
+    return true;
+}
+
+void
+log_segments :: close_table(table* t)
+{
+    for (size_t i = 0; i < t->m_fds.size(); ++i)
+    {
+        if (t->m_fds[i] > 0)
+        {
+            close(t->m_fds[i] - 1);
+        }
+    }
+
+    t->m_fds.clear();
+}
+
+// Descriptors are stored plus one so that zero means "not yet open".
+// Finds the segment holding off and returns how much of [off, off + sz)
+// it holds, or 0 if the segment cannot be opened.
+size_t
+log_segments :: piece(table* t, uint64_t off, size_t sz, int* fd, uint64_t* seg_off)
+{
+    uint64_t idx = 0;
+    *seg_off = off;
+
+    if (m_segment_sz > 0)
+    {
+        idx = off / m_segment_sz;
+        *seg_off = off % m_segment_sz;
+        sz = std::min<uint64_t>(sz, m_segment_sz - *seg_off);
+    }
+
+    *fd = lookup(t, idx);
+    return *fd < 0 ? 0 : sz;
+}
+
+int
+log_segments :: lookup(table* t, uint64_t idx)
+{
+    if (idx >= t->m_fds.size())
+    {
+        std::cerr << "log exceeds " << t->m_fds.size() << " segments" << std::endl;
+        return -1;
+    }
+
+    uint32_t fd = e::atomic::load_32_acquire(&t->m_fds[idx]);
+
+    if (fd > 0)
+    {
+        return fd - 1;
+    }
+
+    po6::threads::mutex::hold hold(&t->m_mtx);
+    fd = e::atomic::load_32_acquire(&t->m_fds[idx]);
+
+    if (fd > 0)
+    {
+        return fd - 1;
+    }
+
+    int opened = -1;
+
+    if (!open_segment(t->m_base, idx, t->m_flags, &opened))
+    {
+        return -1;
+    }
+
+    e::atomic::store_32_release(&t->m_fds[idx], opened + 1);
+    return opened;
+}
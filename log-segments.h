@@ -0,0 +1,127 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of this project nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef kvbench_log_segments_h_
+#define kvbench_log_segments_h_
+
+// C
+#include <stdint.h>
+#include <stdlib.h>
+
+// POSIX
+#include <sys/uio.h>
+
+// STL
+#include <string>
+#include <vector>
+
+// po6
+#include <po6/threads/mutex.h>
+
+// e
+#include <e/popt.h>
+
+// ygor
+#include <ygor/data.h>
+
+// kvbench
+#include "durability.h"
+
+// Splits an append-only file into fixed-size segments, optionally
+// preallocated with fallocate so that writes never extend the file.  With
+// the default --segment-size of 0 there is a single unbounded <base>.dat,
+// as the drivers have always used.  Opening each segment after the first
+// is a rollover, and its latency is recorded in the "rollover" series.
+//
+// Drivers that write at the file position open segments themselves with
+// open_segment and roll when full() says the next record won't fit.
+// Drivers that write at reserved offsets use a table, which maps each
+// offset to its segment, opening segments as writers reach them and
+// splitting reads and writes that straddle a boundary.
+class log_segments
+{
+    public:
+        class table
+        {
+            public:
+                table();
+                ~table() throw ();
+
+            private:
+                friend class log_segments;
+                std::string m_base;
+                int m_flags;
+                std::vector<uint32_t> m_fds;
+                po6::threads::mutex m_mtx;
+
+            private:
+                table(const table&);
+                table& operator = (const table&);
+        };
+
+    public:
+        log_segments();
+        ~log_segments() throw ();
+
+    public:
+        const e::argparser& parser();
+        const ygor_series* series();
+        bool setup(ygor_data_logger* dl);
+        uint64_t segment_size() const { return m_segment_sz; }
+
+    public:
+        bool open_segment(const std::string& base, uint64_t idx, int flags, int* fd);
+        bool full(uint64_t pos, uint64_t sz) const
+        { return m_segment_sz > 0 && pos > 0 && pos + sz > m_segment_sz; }
+
+    public:
+        bool open_table(table* t, const std::string& base, int flags);
+        // writes the record gathered in iov at [off, off + its size) of the
+        // log, then, if d says a sync is due, syncs every segment it touched
+        bool pwrite(table* t, const iovec* iov, int iovcnt, uint64_t off,
+                    durability* d, durability::tracker* dt);
+        bool pread(table* t, char* buf, size_t sz, uint64_t off);
+        void close_table(table* t);
+
+    private:
+        size_t piece(table* t, uint64_t off, size_t sz, int* fd, uint64_t* seg_off);
+        int lookup(table* t, uint64_t idx);
+
+    private:
+        e::argparser m_ap;
+        long m_segment_mb;
+        bool m_preallocate;
+        uint64_t m_segment_sz;
+        ygor_series m_series;
+        ygor_data_logger* m_dl;
+
+    private:
+        log_segments(const log_segments&);
+        log_segments& operator = (const log_segments&);
+};
+
+#endif // kvbench_log_segments_h_
@@ -0,0 +1,208 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of this project nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <string.h>
+
+// STL
+#include <algorithm>
+#include <iostream>
+
+// po6
+#include <po6/time.h>
+
+// e
+#include <e/atomic.h>
+
+// kvbench
+#include "offset-reservation.h"
+
+struct offset_reservation::thread_state
+{
+    thread_state() : next(0), end(0), calls(0), wait(0), max_wait(0) {}
+
+    uint64_t next;
+    uint64_t end;
+    uint64_t calls;
+    uint64_t wait;
+    uint64_t max_wait;
+};
+
+offset_reservation :: offset_reservation()
+    : m_ap()
+    , m_strategy_name("mutex")
+    , m_lease_mb(1)
+    , m_stats(false)
+    , m_strategy(MUTEX)
+    , m_lease_sz(0)
+    , m_mtx()
+    , m_off(0)
+    , m_calls(0)
+    , m_wait(0)
+    , m_max_wait(0)
+{
+    m_ap.arg().long_name("reservation")
+              .description("how writers reserve file offsets: mutex, atomic, or lease (default: mutex)")
+              .metavar("STRATEGY")
+              .as_string(&m_strategy_name);
+    m_ap.arg().long_name("lease-size")
+              .description("size of each per-thread extent with --reservation=lease (default: 1)")
+              .metavar("MB")
+              .as_long(&m_lease_mb);
+    m_ap.arg().long_name("reservation-stats")
+              .description("time each reservation and report the wait at teardown (default: no)")
+              .set_true(&m_stats);
+}
+
+offset_reservation :: ~offset_reservation() throw ()
+{
+}
+
+const e::argparser&
+offset_reservation :: parser()
+{
+    return m_ap;
+}
+
+bool
+offset_reservation :: setup()
+{
+    if (strcmp(m_strategy_name, "mutex") == 0)
+    {
+        m_strategy = MUTEX;
+    }
+    else if (strcmp(m_strategy_name, "atomic") == 0)
+    {
+        m_strategy = ATOMIC;
+    }
+    else if (strcmp(m_strategy_name, "lease") == 0)
+    {
+        m_strategy = LEASE;
+    }
+    else
+    {
+        std::cerr << "unknown reservation strategy \"" << m_strategy_name << "\"" << std::endl;
+        return false;
+    }
+
+    if (m_lease_mb <= 0)
+    {
+        std::cerr << "--lease-size must be positive" << std::endl;
+        return false;
+    }
+
+    m_lease_sz = uint64_t(m_lease_mb) << 20;
+    m_off = 0;
+    return true;
+}
+
+bool
+offset_reservation :: setup_thread(void** ptr)
+{
+    *ptr = new thread_state();
+    return true;
+}
+
+bool
+offset_reservation :: teardown_thread(void* ptr)
+{
+    thread_state* ts = static_cast<thread_state*>(ptr);
+
+    if (ts)
+    {
+        po6::threads::mutex::hold hold(&m_mtx);
+        m_calls += ts->calls;
+        m_wait += ts->wait;
+        m_max_wait = std::max(m_max_wait, ts->max_wait);
+        delete ts;
+    }
+
+    return true;
+}
+
+void
+offset_reservation :: teardown()
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (m_stats && m_calls > 0)
+    {
+        std::cerr << "offset reservation (" << m_strategy_name << "): "
+                  << m_calls << " reservations, "
+                  << m_wait / m_calls << " ns mean wait, "
+                  << m_max_wait << " ns max wait" << std::endl;
+    }
+}
+
+uint64_t
+offset_reservation :: reserve(void* ptr, uint64_t sz)
+{
+    thread_state* ts = static_cast<thread_state*>(ptr);
+    const uint64_t start = m_stats ? po6::monotonic_time() : 0;
+    uint64_t off = 0;
+
+    if (m_strategy != LEASE || sz > m_lease_sz)
+    {
+        off = reserve_shared(sz);
+    }
+    else
+    {
+        if (ts->next + sz > ts->end)
+        {
+            // the unused tail of the old extent is left as a hole
+            ts->next = e::atomic::increment_64_nobarrier(&m_off, m_lease_sz) - m_lease_sz;
+            ts->end = ts->next + m_lease_sz;
+        }
+
+        off = ts->next;
+        ts->next += sz;
+    }
+
+    if (m_stats)
+    {
+        const uint64_t wait = po6::monotonic_time() - start;
+        ++ts->calls;
+        ts->wait += wait;
+        ts->max_wait = std::max(ts->max_wait, wait);
+    }
+
+    return off;
+}
+
+uint64_t
+offset_reservation :: reserve_shared(uint64_t sz)
+{
+    if (m_strategy == MUTEX)
+    {
+        po6::threads::mutex::hold hold(&m_mtx);
+        uint64_t off = m_off;
+        m_off += sz;
+        return off;
+    }
+
+    return e::atomic::increment_64_nobarrier(&m_off, sz) - sz;
+}
@@ -0,0 +1,88 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of this project nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef kvbench_offset_reservation_h_
+#define kvbench_offset_reservation_h_
+
+// C
+#include <stdint.h>
+#include <stdlib.h>
+
+// po6
+#include <po6/threads/mutex.h>
+
+// e
+#include <e/popt.h>
+
+// Hands out disjoint ranges of a shared file to concurrent writers.  The
+// strategy is chosen on the command line so the same driver can show how
+// each one scales:
+//
+//  - mutex:  bump a shared offset under a lock
+//  - atomic: bump a shared offset with a fetch-and-add
+//  - lease:  each thread leases an extent with a fetch-and-add and carves
+//            records out of it without touching shared state
+class offset_reservation
+{
+    public:
+        offset_reservation();
+        ~offset_reservation() throw ();
+
+    public:
+        const e::argparser& parser();
+        bool setup();
+        bool setup_thread(void** ptr);
+        bool teardown_thread(void* ptr);
+        void teardown();
+
+    public:
+        uint64_t reserve(void* ptr, uint64_t sz);
+
+    private:
+        enum strategy_t { MUTEX, ATOMIC, LEASE };
+        struct thread_state;
+        uint64_t reserve_shared(uint64_t sz);
+
+    private:
+        e::argparser m_ap;
+        const char* m_strategy_name;
+        long m_lease_mb;
+        bool m_stats;
+        strategy_t m_strategy;
+        uint64_t m_lease_sz;
+        po6::threads::mutex m_mtx;
+        uint64_t m_off;
+        uint64_t m_calls;
+        uint64_t m_wait;
+        uint64_t m_max_wait;
+
+    private:
+        offset_reservation(const offset_reservation&);
+        offset_reservation& operator = (const offset_reservation&);
+};
+
+#endif // kvbench_offset_reservation_h_
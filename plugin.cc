@@ -0,0 +1,134 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of this project nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <stdlib.h>
+#include <string.h>
+
+// POSIX
+#include <dirent.h>
+#include <dlfcn.h>
+
+// STL
+#include <algorithm>
+#include <iostream>
+
+// po6
+#include <po6/errno.h>
+
+// kvbench
+#include "plugin.h"
+
+#ifndef KVBENCH_PLUGIN_DIR
+#define KVBENCH_PLUGIN_DIR "."
+#endif
+
+#define PLUGIN_PREFIX "kvbench-"
+#define PLUGIN_SUFFIX ".so"
+
+const char*
+plugin :: default_dir()
+{
+    const char* dir = getenv("KVBENCH_PLUGIN_DIR");
+    return dir ? dir : KVBENCH_PLUGIN_DIR;
+}
+
+bool
+plugin :: list(const char* dir, std::vector<std::string>* names)
+{
+    DIR* d = opendir(dir);
+
+    if (!d)
+    {
+        std::cerr << "could not list " << dir << ": " << po6::strerror(errno) << std::endl;
+        return false;
+    }
+
+    const size_t prefix_sz = strlen(PLUGIN_PREFIX);
+    const size_t suffix_sz = strlen(PLUGIN_SUFFIX);
+    struct dirent* ent = NULL;
+
+    while ((ent = readdir(d)))
+    {
+        const std::string file(ent->d_name);
+
+        if (file.size() > prefix_sz + suffix_sz &&
+            file.compare(0, prefix_sz, PLUGIN_PREFIX) == 0 &&
+            file.compare(file.size() - suffix_sz, suffix_sz, PLUGIN_SUFFIX) == 0)
+        {
+            names->push_back(file.substr(prefix_sz, file.size() - prefix_sz - suffix_sz));
+        }
+    }
+
+    closedir(d);
+    std::sort(names->begin(), names->end());
+    return true;
+}
+
+plugin :: plugin()
+    : m_handle(NULL)
+    , m_create(NULL)
+{
+}
+
+plugin :: ~plugin() throw ()
+{
+    if (m_handle)
+    {
+        dlclose(m_handle);
+    }
+}
+
+bool
+plugin :: load(const char* dir, const std::string& name)
+{
+    const std::string path = std::string(dir) + "/" PLUGIN_PREFIX + name + PLUGIN_SUFFIX;
+    m_handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+
+    if (!m_handle)
+    {
+        std::cerr << "could not load database " << name << ": " << dlerror() << std::endl;
+        return false;
+    }
+
+    void* sym = dlsym(m_handle, "kvbench_database_create");
+
+    if (!sym)
+    {
+        std::cerr << "could not load database " << name << ": " << dlerror() << std::endl;
+        return false;
+    }
+
+    m_create = reinterpret_cast<database* (*)()>(sym);
+    return true;
+}
+
+database*
+plugin :: create()
+{
+    return m_create ? m_create() : NULL;
+}
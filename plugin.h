@@ -0,0 +1,66 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of this project nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef kvbench_plugin_h_
+#define kvbench_plugin_h_
+
+// STL
+#include <string>
+#include <vector>
+
+// kvbench
+#include "database.h"
+
+// Database drivers are shared objects named kvbench-<name>.so that export
+// kvbench_database_create, a C wrapper around their database::create().
+// The directory they are loaded from is --plugin-dir, then the
+// KVBENCH_PLUGIN_DIR environment variable, then where they are installed.
+class plugin
+{
+    public:
+        static const char* default_dir();
+        static bool list(const char* dir, std::vector<std::string>* names);
+
+    public:
+        plugin();
+        ~plugin() throw ();
+
+    public:
+        bool load(const char* dir, const std::string& name);
+        // every database must be destroyed before the plugin is
+        database* create();
+
+    private:
+        void* m_handle;
+        database* (*m_create)();
+
+    private:
+        plugin(const plugin&);
+        plugin& operator = (const plugin&);
+};
+
+#endif // kvbench_plugin_h_
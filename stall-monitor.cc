@@ -0,0 +1,183 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of this project nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <time.h>
+
+// STL
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+// po6
+#include <po6/time.h>
+
+// kvbench
+#include "stall-monitor.h"
+
+stall_monitor :: stall_monitor()
+    : m_ap()
+    , m_threshold(0)
+    , m_series()
+    , m_dl(NULL)
+    , m_mtx()
+    , m_start(0)
+    , m_end(0)
+    , m_stalls()
+    , m_wall_offset(0)
+{
+    m_ap.arg().long_name("stall-threshold")
+              .description("report writes slower than T milliseconds as stalls; 0 disables (default: 0)")
+              .metavar("T")
+              .as_long(&m_threshold);
+
+    m_series.name = "stall";
+    m_series.indep_units = YGOR_UNIT_MS;
+    m_series.indep_precision = YGOR_PRECISE_INTEGER;
+    m_series.dep_units = YGOR_UNIT_MS;
+    m_series.dep_precision = YGOR_HALF_PRECISION;
+}
+
+stall_monitor :: ~stall_monitor() throw ()
+{
+}
+
+const e::argparser&
+stall_monitor :: parser()
+{
+    return m_ap;
+}
+
+const ygor_series*
+stall_monitor :: series()
+{
+    return &m_series;
+}
+
+bool
+stall_monitor :: setup(ygor_data_logger* dl)
+{
+    if (m_threshold < 0)
+    {
+        std::cerr << "--stall-threshold must be non-negative" << std::endl;
+        return false;
+    }
+
+    po6::threads::mutex::hold hold(&m_mtx);
+    m_dl = dl;
+    m_start = 0;
+    m_end = 0;
+    m_stalls.clear();
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    m_wall_offset = ts.tv_sec * PO6_SECONDS + ts.tv_nsec - po6::monotonic_time();
+    return true;
+}
+
+bool
+stall_monitor :: observe(uint64_t start, uint64_t end)
+{
+    if (!enabled() || end - start < m_threshold * PO6_MILLIS)
+    {
+        return true;
+    }
+
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (m_end != 0 && start <= m_end)
+    {
+        m_start = std::min(m_start, start);
+        m_end = std::max(m_end, end);
+        return true;
+    }
+
+    if (!close_window())
+    {
+        return false;
+    }
+
+    m_start = start;
+    m_end = end;
+    return true;
+}
+
+bool
+stall_monitor :: teardown(database* db)
+{
+    po6::threads::mutex::hold hold(&m_mtx);
+
+    if (!close_window())
+    {
+        return false;
+    }
+
+    uint64_t total = 0;
+
+    for (size_t i = 0; i < m_stalls.size(); ++i)
+    {
+        const uint64_t start = m_stalls[i].first;
+        const uint64_t end = m_stalls[i].second;
+        std::string cause;
+        total += end - start;
+        std::cerr << "write stall at " << start / PO6_MILLIS << " ms for "
+                  << (end - start) / (double)PO6_MILLIS << " ms";
+
+        if (db->explain_stall(start + m_wall_offset, end + m_wall_offset, &cause))
+        {
+            std::cerr << ": " << cause;
+        }
+
+        std::cerr << std::endl;
+    }
+
+    if (enabled())
+    {
+        std::cerr << m_stalls.size() << " write stalls totalling "
+                  << total / (double)PO6_MILLIS << " ms" << std::endl;
+    }
+
+    return true;
+}
+
+// Called with m_mtx held.
+bool
+stall_monitor :: close_window()
+{
+    if (m_end == 0)
+    {
+        return true;
+    }
+
+    m_stalls.push_back(std::make_pair(m_start, m_end));
+    ygor_data_point dp;
+    dp.series = &m_series;
+    dp.indep.precise = m_start / PO6_MILLIS;
+    dp.dep.approximate = (m_end - m_start) / (double)PO6_MILLIS;
+    m_start = 0;
+    m_end = 0;
+    return !m_dl || ygor_data_logger_record(m_dl, &dp) >= 0;
+}
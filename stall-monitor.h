@@ -0,0 +1,92 @@
+// Copyright (c) 2016, Robert Escriva
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of this project nor the names of its contributors may
+//       be used to endorse or promote products derived from this software
+//       without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef kvbench_stall_monitor_h_
+#define kvbench_stall_monitor_h_
+
+// C
+#include <stdint.h>
+
+// STL
+#include <utility>
+#include <vector>
+
+// po6
+#include <po6/threads/mutex.h>
+
+// e
+#include <e/popt.h>
+
+// ygor
+#include <ygor/data.h>
+
+// kvbench
+#include "database.h"
+
+// Detects write stalls: windows in which writes take longer than
+// --stall-threshold milliseconds.  Slow writes from all threads whose
+// intervals overlap are merged into a single stall.  Each stall is
+// recorded in the "stall" series at its start time with its duration.  At
+// teardown, every stall is printed, along with the database's explanation
+// of what it was doing at the time, if it has one.
+class stall_monitor
+{
+    public:
+        stall_monitor();
+        ~stall_monitor() throw ();
+
+    public:
+        const e::argparser& parser();
+        const ygor_series* series();
+        bool enabled() const { return m_threshold > 0; }
+        bool setup(ygor_data_logger* dl);
+        // start and end are the monotonic times of one write
+        bool observe(uint64_t start, uint64_t end);
+        bool teardown(database* db);
+
+    private:
+        bool close_window();
+
+    private:
+        e::argparser m_ap;
+        long m_threshold;
+        ygor_series m_series;
+        ygor_data_logger* m_dl;
+        po6::threads::mutex m_mtx;
+        // the stall in progress; m_end is zero when there is none
+        uint64_t m_start;
+        uint64_t m_end;
+        std::vector<std::pair<uint64_t, uint64_t> > m_stalls;
+        // wallclock time minus monotonic time, for explaining stalls
+        uint64_t m_wall_offset;
+
+    private:
+        stall_monitor(const stall_monitor&);
+        stall_monitor& operator = (const stall_monitor&);
+};
+
+#endif // kvbench_stall_monitor_h_
@@ -25,6 +25,18 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+// C
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// STL
+#include <algorithm>
+#include <string>
+#include <vector>
+
 // po6
 #include <po6/time.h>
 
@@ -32,8 +44,24 @@
 #include <e/atomic.h>
 
 // kvbench
+#include "coroutine-clients.h"
 #include "workload-ycsb-core.h"
 
+// One of a thread's --queue-depth ops.  The key and value are copies, as
+// the generators reuse their buffers.  A read-modify-write is submitted as
+// a read, then again as a write once the read completes.
+struct workload_ycsb_core::async_slot
+{
+    async_slot() : op(), w(NULL), ts(NULL), series(NULL), key(), val() {}
+
+    database_op op;
+    workload_ycsb_core* w;
+    thread_state* ts;
+    const ygor_series* series;
+    std::string key;
+    std::string val;
+};
+
 struct workload_ycsb_core::thread_state
 {
     thread_state();
@@ -44,6 +72,31 @@ struct workload_ycsb_core::thread_state
     armnod_generator* keygen;
     armnod_generator* valgen;
 
+    // with --batch, gets and puts wait here for the next multi_get or
+    // multi_put; each op's series is recorded once the batch completes
+    std::vector<std::string> get_keys;
+    std::vector<const ygor_series*> get_series;
+    size_t gets;
+    std::vector<std::string> put_keys;
+    std::vector<std::string> put_vals;
+    std::vector<const ygor_series*> put_series;
+    size_t puts;
+    std::vector<const char*> ptrs;
+    std::vector<size_t> szs;
+
+    // with --queue-depth, the ops in flight and those free to issue;
+    // callbacks leave writes of read-modify-writes in resubmit
+    std::vector<async_slot> slots;
+    std::vector<async_slot*> free_slots;
+    std::vector<async_slot*> resubmit;
+    size_t inflight;
+    bool failed;
+
+    // with --rate, when the next op should start and the state of the
+    // thread's arrival process
+    uint64_t arrival;
+    unsigned short xsubi[3];
+
     private:
         thread_state(const thread_state&);
         thread_state& operator = (const thread_state&);
@@ -54,7 +107,23 @@ workload_ycsb_core :: thread_state :: thread_state()
     , opgen(NULL)
     , keygen(NULL)
     , valgen(NULL)
+    , get_keys()
+    , get_series()
+    , gets(0)
+    , put_keys()
+    , put_vals()
+    , put_series()
+    , puts(0)
+    , ptrs()
+    , szs()
+    , slots()
+    , free_slots()
+    , resubmit()
+    , inflight(0)
+    , failed(false)
+    , arrival(0)
 {
+    xsubi[0] = xsubi[1] = xsubi[2] = 0;
 }
 
 workload_ycsb_core :: thread_state :: ~thread_state() throw ()
@@ -76,12 +145,24 @@ workload_ycsb_core :: workload_ycsb_core()
     , m_weight_modify(0)
     , m_weight_delete(0)
     , m_weight_scan(0)
+    , m_batch(1)
+    , m_queue_depth(0)
+    , m_clients(0)
+    , m_pool_threads(16)
+    , m_threads(0)
+    , m_rate(0)
+    , m_arrival("poisson")
+    , m_poisson(true)
+    , m_interval(0)
     , m_ops_done(0)
     , m_series_read()
     , m_series_write()
     , m_series_modify()
     , m_series_delete()
     , m_series_scan()
+    , m_series_multi_get()
+    , m_series_multi_put()
+    , m_stalls()
 {
     m_ap.add("Key Generation:", m_key_parser->parser());
     m_ap.add("Value Generation:", m_val_parser->parser());
@@ -109,6 +190,31 @@ workload_ycsb_core :: workload_ycsb_core()
               .description("weight assigned to scan operations (default: 0)")
               .metavar("#")
               .as_long(&m_weight_scan);
+    m_ap.arg().long_name("batch")
+              .description("issue reads and writes N at a time through multi_get and multi_put (default: 1)")
+              .metavar("N")
+              .as_long(&m_batch);
+    m_ap.arg().long_name("queue-depth")
+              .description("keep up to N operations in flight per thread with the asynchronous calls (default: 0, synchronous)")
+              .metavar("N")
+              .as_long(&m_queue_depth);
+    m_ap.arg().long_name("clients")
+              .description("run N coroutine clients per thread, each with one operation in flight (default: 0, off)")
+              .metavar("N")
+              .as_long(&m_clients);
+    m_ap.arg().long_name("pool-threads")
+              .description("with --queue-depth or --clients, threads per queue for databases without native asynchronous calls (default: 16)")
+              .metavar("N")
+              .as_long(&m_pool_threads);
+    m_ap.arg().long_name("rate")
+              .description("issue N operations per second across all threads, open loop (default: 0, closed loop)")
+              .metavar("N")
+              .as_long(&m_rate);
+    m_ap.arg().long_name("arrival")
+              .description("arrivals at --rate are poisson or uniform (default: poisson)")
+              .metavar("DIST")
+              .as_string(&m_arrival);
+    m_ap.add("Write Stalls:", m_stalls.parser());
 
     m_series_read.name = "read";
     m_series_read.indep_units = YGOR_UNIT_MS;
@@ -140,11 +246,17 @@ workload_ycsb_core :: workload_ycsb_core()
     m_series_scan.dep_units = YGOR_UNIT_MS;
     m_series_scan.dep_precision = YGOR_HALF_PRECISION;
 
-    m_series[0] = &m_series_read;
-    m_series[1] = &m_series_write;
-    m_series[2] = &m_series_modify;
-    m_series[3] = &m_series_delete;
-    m_series[4] = &m_series_scan;
+    m_series_multi_get.name = "multi-get";
+    m_series_multi_get.indep_units = YGOR_UNIT_MS;
+    m_series_multi_get.indep_precision = YGOR_PRECISE_INTEGER;
+    m_series_multi_get.dep_units = YGOR_UNIT_MS;
+    m_series_multi_get.dep_precision = YGOR_HALF_PRECISION;
+
+    m_series_multi_put.name = "multi-put";
+    m_series_multi_put.indep_units = YGOR_UNIT_MS;
+    m_series_multi_put.indep_precision = YGOR_PRECISE_INTEGER;
+    m_series_multi_put.dep_units = YGOR_UNIT_MS;
+    m_series_multi_put.dep_precision = YGOR_HALF_PRECISION;
 }
 
 workload_ycsb_core :: ~workload_ycsb_core() throw ()
@@ -160,19 +272,81 @@ workload_ycsb_core :: parser()
 const ygor_series**
 workload_ycsb_core :: series()
 {
+    fill_series();
     return m_series;
 }
 
 size_t
 workload_ycsb_core :: series_sz()
 {
-    return 5;
+    return fill_series();
 }
 
 bool
-workload_ycsb_core :: setup(unsigned)
+workload_ycsb_core :: setup(unsigned num_threads)
 {
     po6::threads::mutex::hold hold(&m_mtx);
+
+    if (!m_stalls.setup(m_dl))
+    {
+        return false;
+    }
+
+    if (m_batch < 1)
+    {
+        std::cerr << "--batch must be at least 1" << std::endl;
+        return false;
+    }
+
+    if (m_queue_depth < 0 || m_clients < 0)
+    {
+        std::cerr << "--queue-depth and --clients must be non-negative" << std::endl;
+        return false;
+    }
+
+    if (m_pool_threads < 1)
+    {
+        std::cerr << "--pool-threads must be at least 1" << std::endl;
+        return false;
+    }
+
+    if ((m_queue_depth > 0) + (m_clients > 0) + (m_batch > 1) > 1)
+    {
+        std::cerr << "--queue-depth, --clients, and --batch cannot be combined" << std::endl;
+        return false;
+    }
+
+    if (m_rate < 0)
+    {
+        std::cerr << "--rate must be non-negative" << std::endl;
+        return false;
+    }
+
+    if (m_rate > 0 && (m_queue_depth > 0 || m_clients > 0 || m_batch > 1))
+    {
+        std::cerr << "--rate cannot be combined with --queue-depth, --clients, or --batch" << std::endl;
+        return false;
+    }
+
+    if (strcmp(m_arrival, "poisson") != 0 && strcmp(m_arrival, "uniform") != 0)
+    {
+        std::cerr << "--arrival must be poisson or uniform" << std::endl;
+        return false;
+    }
+
+    m_threads = num_threads;
+    m_poisson = strcmp(m_arrival, "poisson") == 0;
+    // each thread runs its own schedule at its share of the rate
+    m_interval = m_rate > 0 ? (double)PO6_SECONDS * num_threads / m_rate : 0;
+
+#ifndef KVBENCH_COROUTINES
+    if (m_clients > 0)
+    {
+        std::cerr << "--clients needs kvbench built with C++20 coroutines" << std::endl;
+        return false;
+    }
+#endif
+
     double sum = m_weight_read + m_weight_write + m_weight_modify + m_weight_delete;
 
     for (unsigned idx = 0; idx < 256; ++idx)
@@ -209,7 +383,7 @@ workload_ycsb_core :: setup(unsigned)
 }
 
 bool
-workload_ycsb_core :: setup_thread(unsigned, void** ptr)
+workload_ycsb_core :: setup_thread(unsigned idx, void** ptr)
 {
     po6::threads::mutex::hold hold(&m_mtx);
     std::auto_ptr<thread_state> ts(new thread_state());
@@ -221,91 +395,115 @@ workload_ycsb_core :: setup_thread(unsigned, void** ptr)
     ts->keygen = armnod_generator_create(m_key_parser->config());
     ts->valgen = armnod_generator_create(m_val_parser->config());
 
-    uint64_t seed = (uintptr_t)pthread_self();
+    // seeded by thread so that every database sees the same operations
+    uint64_t seed = idx + 1;
     armnod_seed(ts->opgen,  seed);
     armnod_seed(ts->keygen, seed ^ (0x55aaULL << 48));
     armnod_seed(ts->valgen, seed ^ (0xaa55ULL << 48));
+    ts->xsubi[0] = seed;
+    ts->xsubi[1] = seed >> 16;
+    ts->xsubi[2] = 0x330e;
+
+    ts->get_keys.resize(m_batch);
+    ts->get_series.resize(m_batch);
+    ts->put_keys.resize(m_batch);
+    ts->put_vals.resize(m_batch);
+    ts->put_series.resize(m_batch);
+    ts->ptrs.resize(3 * m_batch);
+    ts->szs.resize(3 * m_batch);
+    ts->slots.resize(std::max(m_queue_depth, m_clients));
+
+    for (size_t i = 0; i < ts->slots.size(); ++i)
+    {
+        ts->slots[i].w = this;
+        ts->slots[i].ts = ts.get();
+        ts->slots[i].op.callback = &workload_ycsb_core::async_done;
+        ts->slots[i].op.arg = &ts->slots[i];
+        ts->free_slots.push_back(&ts->slots[i]);
+    }
     *ptr = ts.release();
     return true;
 }
 
 bool
-workload_ycsb_core :: run(void* db_state, void* work_state, unsigned)
+workload_ycsb_core :: run(void* db_state, void* work_state, unsigned thread)
 {
     thread_state* ts = static_cast<thread_state*>(work_state);
 
+    if (m_queue_depth > 0)
+    {
+        return run_async(db_state, ts, thread);
+    }
+
+#ifdef KVBENCH_COROUTINES
+    if (m_clients > 0)
+    {
+        return run_coroutines(db_state, ts, thread);
+    }
+#endif
+
+    ts->arrival = po6::monotonic_time();
+
     while (e::atomic::increment_64_nobarrier(&m_ops_done, 1) <= (unsigned long)m_max_ops)
     {
         unsigned idx = armnod_generate_idx_only(ts->opgen);
         assert(idx < 256);
+        const char op = m_ops[idx];
         size_t key_sz = 0;
         const char* key = armnod_generate_sz(ts->keygen, &key_sz);
-        size_t val_sz = 0;
-        const char* val = NULL;
 
         if (!key)
         {
             break;
         }
 
-        ygor_data_point dp;
-        const uint64_t start = po6::monotonic_time();
-        dp.series = NULL;
+        // deletes and scans run alone, so they first flush the batch
+        // queued ahead of them to keep the generated order across types
+        if (m_batch > 1 && (op == 'D' || op == 'S') &&
+            (ts->gets > 0 || ts->puts > 0) && !run_batch(db_state, ts))
+        {
+            return false;
+        }
 
-        switch (m_ops[idx])
+        if (m_batch == 1 || op == 'D' || op == 'S')
         {
-            case 'R':
-            case 'M':
-                if (!m_db->get(db_state, key, key_sz))
-                {
-                    return false;
-                }
-                if (m_ops[idx] == 'R')
-                {
-                    dp.series = &m_series_read;
-                    break;
-                }
-                dp.series = &m_series_modify;
-                assert(m_ops[idx] == 'M');
-            case 'W':
-                val = armnod_generate_sz(ts->valgen, &val_sz);
-                if (!m_db->put(db_state, key, key_sz, val, val_sz))
-                {
-                    return false;
-                }
-                dp.series = &m_series_write;
-                break;
-            case 'D':
-                if (!m_db->del(db_state, key, key_sz))
-                {
-                    return false;
-                }
-                dp.series = &m_series_delete;
-                break;
-            case 'S':
-                if (!m_db->scan(db_state, key, key_sz, 10))
-                {
-                    return false;
-                }
-                dp.series = &m_series_scan;
-                break;
-            default:
-                std::cerr << "corrupt internal state\n";
+            const uint64_t start = m_rate > 0 ? next_arrival(ts) : po6::monotonic_time();
+
+            if (!run_op(db_state, ts, op, key, key_sz, start))
+            {
                 return false;
+            }
+
+            continue;
         }
 
-        const uint64_t end = po6::monotonic_time();
-        assert(dp.series);
-        dp.indep.precise = end / PO6_MILLIS;
-        dp.dep.approximate = (end - start) / (double)PO6_MILLIS;
+        // the generators reuse their buffers, so queued ops keep copies;
+        // a batch's gets all run before its puts
+        if (op == 'R' || op == 'M')
+        {
+            ts->get_keys[ts->gets].assign(key, key_sz);
+            ts->get_series[ts->gets] = op == 'R' ? &m_series_read : NULL;
+            ++ts->gets;
+        }
 
-        if (ygor_data_logger_record(m_dl, &dp) < 0)
+        if (op == 'W' || op == 'M')
+        {
+            size_t val_sz = 0;
+            const char* val = armnod_generate_sz(ts->valgen, &val_sz);
+            ts->put_keys[ts->puts].assign(key, key_sz);
+            ts->put_vals[ts->puts].assign(val, val_sz);
+            ts->put_series[ts->puts] = op == 'W' ? &m_series_write : &m_series_modify;
+            ++ts->puts;
+        }
+
+        if ((ts->gets == (size_t)m_batch || ts->puts == (size_t)m_batch) &&
+            !run_batch(db_state, ts))
         {
             return false;
         }
     }
 
-    return true;
+    return (ts->gets == 0 && ts->puts == 0) || run_batch(db_state, ts);
 }
 
 bool
@@ -318,3 +516,433 @@ workload_ycsb_core :: teardown_thread(void* ptr)
 
     return true;
 }
+
+bool
+workload_ycsb_core :: teardown()
+{
+    return m_stalls.teardown(m_db);
+}
+
+size_t
+workload_ycsb_core :: fill_series()
+{
+    size_t n = 0;
+    m_series[n++] = &m_series_read;
+    m_series[n++] = &m_series_write;
+    m_series[n++] = &m_series_modify;
+    m_series[n++] = &m_series_delete;
+    m_series[n++] = &m_series_scan;
+
+    if (m_batch > 1)
+    {
+        m_series[n++] = &m_series_multi_get;
+        m_series[n++] = &m_series_multi_put;
+    }
+
+    if (m_stalls.enabled())
+    {
+        m_series[n++] = m_stalls.series();
+    }
+
+    return n;
+}
+
+bool
+workload_ycsb_core :: run_op(void* db_state, thread_state* ts, char op,
+                             const char* key, size_t key_sz, uint64_t start)
+{
+    size_t val_sz = 0;
+    const char* val = NULL;
+    const ygor_series* series = NULL;
+
+    switch (op)
+    {
+        case 'R':
+        case 'M':
+            if (!m_db->get(db_state, key, key_sz))
+            {
+                return false;
+            }
+            if (op == 'R')
+            {
+                series = &m_series_read;
+                break;
+            }
+            assert(op == 'M');
+        case 'W':
+            val = armnod_generate_sz(ts->valgen, &val_sz);
+            if (!m_db->put(db_state, key, key_sz, val, val_sz))
+            {
+                return false;
+            }
+            series = op == 'M' ? &m_series_modify : &m_series_write;
+            break;
+        case 'D':
+            if (!m_db->del(db_state, key, key_sz))
+            {
+                return false;
+            }
+            series = &m_series_delete;
+            break;
+        case 'S':
+            if (!m_db->scan(db_state, key, key_sz, 10))
+            {
+                return false;
+            }
+            series = &m_series_scan;
+            break;
+        default:
+            std::cerr << "corrupt internal state\n";
+            return false;
+    }
+
+    const uint64_t end = po6::monotonic_time();
+    assert(series);
+
+    if (!record(series, start, end))
+    {
+        return false;
+    }
+
+    return (op != 'W' && op != 'M') || m_stalls.observe(start, end);
+}
+
+// With --rate the thread issues each op at its scheduled arrival rather
+// than when the previous op returns, sleeping if it is early.  A late op
+// is issued immediately but still timed from its arrival, so time spent
+// waiting behind a slow op counts against the ops it delayed instead of
+// going unrecorded.  po6::monotonic_time reads CLOCK_MONOTONIC.
+uint64_t
+workload_ycsb_core :: next_arrival(thread_state* ts)
+{
+    double gap = m_interval;
+
+    if (m_poisson)
+    {
+        gap = -log(1 - erand48(ts->xsubi)) * m_interval;
+    }
+
+    ts->arrival += gap;
+    const uint64_t now = po6::monotonic_time();
+
+    if (now < ts->arrival)
+    {
+        timespec deadline;
+        deadline.tv_sec = ts->arrival / PO6_SECONDS;
+        deadline.tv_nsec = ts->arrival % PO6_SECONDS;
+
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR)
+        {
+        }
+    }
+
+    return ts->arrival;
+}
+
+// Reads record the multi_get's latency, writes the multi_put's, and
+// read-modify-writes both.
+bool
+workload_ycsb_core :: run_batch(void* db_state, thread_state* ts)
+{
+    const char** get_keys = &ts->ptrs[0];
+    size_t* get_key_szs = &ts->szs[0];
+    const char** put_keys = &ts->ptrs[m_batch];
+    size_t* put_key_szs = &ts->szs[m_batch];
+    const char** put_vals = &ts->ptrs[2 * m_batch];
+    size_t* put_val_szs = &ts->szs[2 * m_batch];
+
+    for (size_t i = 0; i < ts->gets; ++i)
+    {
+        get_keys[i] = ts->get_keys[i].data();
+        get_key_szs[i] = ts->get_keys[i].size();
+    }
+
+    for (size_t i = 0; i < ts->puts; ++i)
+    {
+        put_keys[i] = ts->put_keys[i].data();
+        put_key_szs[i] = ts->put_keys[i].size();
+        put_vals[i] = ts->put_vals[i].data();
+        put_val_szs[i] = ts->put_vals[i].size();
+    }
+
+    const uint64_t start = po6::monotonic_time();
+
+    if (ts->gets > 0 &&
+        !m_db->multi_get(db_state, ts->gets, get_keys, get_key_szs))
+    {
+        return false;
+    }
+
+    const uint64_t mid = po6::monotonic_time();
+
+    if (ts->puts > 0 &&
+        !m_db->multi_put(db_state, ts->puts, put_keys, put_key_szs, put_vals, put_val_szs))
+    {
+        return false;
+    }
+
+    const uint64_t end = po6::monotonic_time();
+
+    for (size_t i = 0; i < ts->gets; ++i)
+    {
+        if (ts->get_series[i] && !record(ts->get_series[i], start, mid))
+        {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < ts->puts; ++i)
+    {
+        const bool modify = ts->put_series[i] == &m_series_modify;
+
+        if (!record(ts->put_series[i], modify ? start : mid, end))
+        {
+            return false;
+        }
+    }
+
+    if (ts->gets > 0 && !record(&m_series_multi_get, start, mid))
+    {
+        return false;
+    }
+
+    if (ts->puts > 0 &&
+        (!record(&m_series_multi_put, mid, end) ||
+         !m_stalls.observe(mid, end)))
+    {
+        return false;
+    }
+
+    ts->gets = 0;
+    ts->puts = 0;
+    return true;
+}
+
+// Each op is timed from its submission to its callback, so the latency
+// includes any time spent queued behind the others in flight.
+bool
+workload_ycsb_core :: run_async(void* db_state, thread_state* ts, unsigned idx)
+{
+    void* queue = NULL;
+
+    if (!setup_async(idx, db_state, m_queue_depth, &queue))
+    {
+        return false;
+    }
+
+    bool more = true;
+    bool success = true;
+
+    while (success && !ts->failed && (more || ts->inflight > 0))
+    {
+        while (success && !ts->resubmit.empty())
+        {
+            async_slot* s = ts->resubmit.back();
+            ts->resubmit.pop_back();
+            success = m_db->submit(queue, &s->op);
+        }
+
+        if (!success || !more || ts->free_slots.empty())
+        {
+            success = success && (ts->inflight == 0 || m_db->poll(queue, 1));
+            continue;
+        }
+
+        async_slot* s = ts->free_slots.back();
+
+        if (!next_op(ts, s, &more))
+        {
+            return false;
+        }
+
+        if (!more)
+        {
+            continue;
+        }
+
+        ts->free_slots.pop_back();
+        ++ts->inflight;
+        success = m_db->submit(queue, &s->op);
+    }
+
+    return m_db->teardown_async(queue) && success && !ts->failed;
+}
+
+// Any threads behind thread idx's queue are numbered after the workload's
+// own threads, --pool-threads apiece.
+bool
+workload_ycsb_core :: setup_async(unsigned idx, void* db_state, unsigned depth, void** queue)
+{
+    return m_db->setup_async(m_threads + idx * m_pool_threads, db_state,
+                             depth, m_pool_threads, queue);
+}
+
+void
+workload_ycsb_core :: async_done(database_op* op, bool success)
+{
+    async_slot* s = static_cast<async_slot*>(op->arg);
+    thread_state* ts = s->ts;
+    bool again = false;
+
+    if (!s->w->finish_op(s, success, &again))
+    {
+        ts->failed = true;
+    }
+
+    if (again)
+    {
+        ts->resubmit.push_back(s);
+        return;
+    }
+
+    --ts->inflight;
+    ts->free_slots.push_back(s);
+}
+
+#ifdef KVBENCH_COROUTINES
+// Client i issues the ops of slot i.
+class workload_ycsb_core::client_source : public client_ops
+{
+    public:
+        client_source(workload_ycsb_core* w, thread_state* ts) : m_w(w), m_ts(ts) {}
+        virtual ~client_source() throw () {}
+
+    public:
+        virtual database_op* next(unsigned client)
+        {
+            async_slot* s = &m_ts->slots[client];
+            bool more = false;
+
+            if (!m_w->next_op(m_ts, s, &more))
+            {
+                m_ts->failed = true;
+                return NULL;
+            }
+
+            return more ? &s->op : NULL;
+        }
+
+        virtual bool complete(unsigned client, database_op*,
+                              bool success, bool* again)
+        {
+            return m_w->finish_op(&m_ts->slots[client], success, again);
+        }
+
+    private:
+        workload_ycsb_core* m_w;
+        thread_state* m_ts;
+
+    private:
+        client_source(const client_source&);
+        client_source& operator = (const client_source&);
+};
+
+bool
+workload_ycsb_core :: run_coroutines(void* db_state, thread_state* ts, unsigned idx)
+{
+    void* queue = NULL;
+
+    if (!setup_async(idx, db_state, m_clients, &queue))
+    {
+        return false;
+    }
+
+    client_source source(this, ts);
+    return run_clients(m_db, queue, m_clients, &source) && !ts->failed;
+}
+#endif
+
+// Fills in s with the thread's next op and stamps its start, or clears
+// *more once the workload has issued --max-ops.
+bool
+workload_ycsb_core :: next_op(thread_state* ts, async_slot* s, bool* more)
+{
+    if (e::atomic::increment_64_nobarrier(&m_ops_done, 1) > (unsigned long)m_max_ops)
+    {
+        *more = false;
+        return true;
+    }
+
+    unsigned idx = armnod_generate_idx_only(ts->opgen);
+    assert(idx < 256);
+    size_t key_sz = 0;
+    const char* key = armnod_generate_sz(ts->keygen, &key_sz);
+    size_t val_sz = 0;
+    const char* val = NULL;
+
+    if (!key)
+    {
+        *more = false;
+        return true;
+    }
+
+    s->key.assign(key, key_sz);
+    s->op.key = s->key.data();
+    s->op.key_sz = s->key.size();
+    s->op.val = NULL;
+    s->op.val_sz = 0;
+    s->op.num = 0;
+
+    switch (m_ops[idx])
+    {
+        case 'R':
+            s->op.type = 'R';
+            s->series = &m_series_read;
+            break;
+        case 'M':
+        case 'W':
+            val = armnod_generate_sz(ts->valgen, &val_sz);
+            s->val.assign(val, val_sz);
+            s->op.type = m_ops[idx] == 'M' ? 'R' : 'W';
+            s->op.val = s->val.data();
+            s->op.val_sz = s->val.size();
+            s->series = m_ops[idx] == 'M' ? &m_series_modify : &m_series_write;
+            break;
+        case 'D':
+            s->op.type = 'D';
+            s->series = &m_series_delete;
+            break;
+        case 'S':
+            s->op.type = 'S';
+            s->op.num = 10;
+            s->series = &m_series_scan;
+            break;
+        default:
+            std::cerr << "corrupt internal state\n";
+            return false;
+    }
+
+    *more = true;
+    s->op.start = po6::monotonic_time();
+    return true;
+}
+
+// Records a completed op, or turns the read of a read-modify-write into
+// its write and sets *again.
+bool
+workload_ycsb_core :: finish_op(async_slot* s, bool success, bool* again)
+{
+    *again = false;
+
+    if (success && s->op.type == 'R' && s->series == &m_series_modify)
+    {
+        s->op.type = 'W';
+        *again = true;
+        return true;
+    }
+
+    const uint64_t end = po6::monotonic_time();
+    return success &&
+           record(s->series, s->op.start, end) &&
+           (s->op.type != 'W' || m_stalls.observe(s->op.start, end));
+}
+
+bool
+workload_ycsb_core :: record(const ygor_series* s, uint64_t start, uint64_t end)
+{
+    ygor_data_point dp;
+    dp.series = s;
+    dp.indep.precise = end / PO6_MILLIS;
+    dp.dep.approximate = (end - start) / (double)PO6_MILLIS;
+    return ygor_data_logger_record(m_dl, &dp) >= 0;
+}
@@ -35,6 +35,7 @@
 #include <ygor/armnod.h>
 
 // kvbench
+#include "stall-monitor.h"
 #include "workload.h"
 
 class workload_ycsb_core : public workload
@@ -53,9 +54,24 @@ class workload_ycsb_core : public workload
         virtual bool setup_thread(unsigned idx, void** ptr);
         virtual bool run(void* db_state, void* work_state, unsigned idx);
         virtual bool teardown_thread(void* ptr);
+        virtual bool teardown();
 
     private:
         struct thread_state;
+        struct async_slot;
+        class client_source;
+        static void async_done(database_op* op, bool success);
+        size_t fill_series();
+        bool run_op(void* db_state, thread_state* ts, char op,
+                    const char* key, size_t key_sz, uint64_t start);
+        uint64_t next_arrival(thread_state* ts);
+        bool run_batch(void* db_state, thread_state* ts);
+        bool run_async(void* db_state, thread_state* ts, unsigned idx);
+        bool run_coroutines(void* db_state, thread_state* ts, unsigned idx);
+        bool setup_async(unsigned idx, void* db_state, unsigned depth, void** queue);
+        bool next_op(thread_state* ts, async_slot* s, bool* more);
+        bool finish_op(async_slot* s, bool success, bool* again);
+        bool record(const ygor_series* s, uint64_t start, uint64_t end);
 
     private:
         e::argparser m_ap;
@@ -68,6 +84,15 @@ class workload_ycsb_core : public workload
         long m_weight_modify;
         long m_weight_delete;
         long m_weight_scan;
+        long m_batch;
+        long m_queue_depth;
+        long m_clients;
+        long m_pool_threads;
+        unsigned m_threads;
+        long m_rate;
+        const char* m_arrival;
+        bool m_poisson;
+        double m_interval;
         char m_ops[256];
         uint64_t m_ops_done;
         ygor_series m_series_read;
@@ -75,7 +100,10 @@ class workload_ycsb_core : public workload
         ygor_series m_series_modify;
         ygor_series m_series_delete;
         ygor_series m_series_scan;
-        const ygor_series* m_series[5];
+        ygor_series m_series_multi_get;
+        ygor_series m_series_multi_put;
+        const ygor_series* m_series[8];
+        stall_monitor m_stalls;
 
     private:
         workload_ycsb_core(const workload_ycsb_core&);